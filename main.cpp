@@ -1,9 +1,16 @@
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
+#include "ref_counter_tracking.h"
+#include <cstdio>
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
 
 int main(int argc, char** argv) {
   printf("Running main() from %s\n", __FILE__);
 
+#if defined(_MSC_VER) && defined(_DEBUG)
   int flag = _CrtSetDbgFlag(_CRTDBG_REPORT_FLAG);
   flag |= _CRTDBG_LEAK_CHECK_DF;
   flag |= _CRTDBG_ALLOC_MEM_DF;
@@ -11,5 +18,10 @@ int main(int argc, char** argv) {
   _CrtSetReportMode(_CRT_WARN, _CRTDBG_MODE_FILE | _CRTDBG_MODE_DEBUG);
   _CrtSetReportFile(_CRT_WARN, _CRTDBG_FILE_STDERR);
   _CrtSetBreakAlloc(-1);
+#endif
+#if REF_COUNTER_TRACK_REFERENCES
+  ref_counter::DumpLiveReferencesAtExit();
+#endif
   int result = Catch::Session().run(argc, argv);
+  return result;
 }
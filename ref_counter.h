@@ -2,97 +2,1262 @@
 #define REF_COUNTER_H_
 
 #include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <new>
 #include <ostream>
 #include <type_traits>
 #include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Records where every RefCounterPtr reference was taken, see
+// ref_counter_tracking.h. Must be the same for the whole program.
+#ifndef REF_COUNTER_TRACK_REFERENCES
+#define REF_COUNTER_TRACK_REFERENCES 0
+#endif
+
+#if REF_COUNTER_TRACK_REFERENCES
+#include "ref_counter_tracking.h"
+#endif
+
+// In tracking mode the RefCounterPtr members that take a reference are kept
+// out of line, so REF_COUNTER_CALL_SITE(), their return address, is the code
+// that took it whatever the compiler inlines around it.
+#if REF_COUNTER_TRACK_REFERENCES && defined(_MSC_VER)
+#include <intrin.h>
+#define REF_COUNTER_TRACKED_ACQUIRE __declspec(noinline)
+#define REF_COUNTER_CALL_SITE() _ReturnAddress()
+#elif REF_COUNTER_TRACK_REFERENCES && defined(__GNUC__)
+#define REF_COUNTER_TRACKED_ACQUIRE __attribute__((noinline))
+#define REF_COUNTER_CALL_SITE() __builtin_return_address(0)
+#else
+#define REF_COUNTER_TRACKED_ACQUIRE
+#define REF_COUNTER_CALL_SITE() nullptr
+#endif
+
+// ThreadSanitizer does not model std::atomic_thread_fence; under it the
+// decrements acquire by themselves instead of fencing after the last one.
+#ifndef REF_COUNTER_THREAD_SANITIZER
+#if defined(__SANITIZE_THREAD__)
+#define REF_COUNTER_THREAD_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define REF_COUNTER_THREAD_SANITIZER 1
+#endif
+#endif
+#endif
+#ifndef REF_COUNTER_THREAD_SANITIZER
+#define REF_COUNTER_THREAD_SANITIZER 0
+#endif
+
+// Asserts that every TransferToken is adopted exactly once. On unless
+// NDEBUG; adds a flag to the token.
+#ifndef REF_COUNTER_TRANSFER_CHECKS
+#ifdef NDEBUG
+#define REF_COUNTER_TRANSFER_CHECKS 0
+#else
+#define REF_COUNTER_TRANSFER_CHECKS 1
+#endif
+#endif
 
 namespace ref_counter
 {
-  struct ThreadUnsafeCounter
+#if !REF_COUNTER_TRACK_REFERENCES
+  namespace detail
+  {
+    // Empty base of RefCounterPtr when references are not tracked.
+    class ReferenceTracker
+    {
+    protected:
+      void TrackAcquire(void const*, void*) noexcept {}
+      void TrackRelease() noexcept {}
+      void TrackMove(ReferenceTracker&) noexcept {}
+      void TrackSwap(ReferenceTracker&) noexcept {}
+    };
+  } // namespace detail
+
+#endif
+  // What a policy does when a count would leave its range: Wrap is plain
+  // unsigned arithmetic, Saturate pins the count at its maximum and makes the
+  // object immortal, Terminate calls std::terminate.
+  enum class CounterOverflow
   {
-    typedef unsigned int Type;
+    Wrap,
+    Saturate,
+    Terminate
+  };
 
-    static unsigned int Load(Type const& counter) noexcept
+  namespace detail
+  {
+    [[noreturn]] inline void CounterOverflowed() noexcept {
+      std::terminate();
+    }
+
+    // Order of a decrement that may drop the last reference, and the fence
+    // its caller issues once it has, see REF_COUNTER_THREAD_SANITIZER.
+#if REF_COUNTER_THREAD_SANITIZER
+    constexpr std::memory_order kReleaseDecrement = std::memory_order_acq_rel;
+
+    inline void AcquireLastRelease() noexcept {}
+#else
+    constexpr std::memory_order kReleaseDecrement = std::memory_order_release;
+
+    inline void AcquireLastRelease() noexcept {
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+#endif
+  } // namespace detail
+
+  template<typename T, CounterOverflow Overflow = CounterOverflow::Wrap>
+  struct BasicThreadUnsafeCounter
+  {
+    static_assert(std::is_unsigned<T>::value, "counter type must be unsigned");
+
+    typedef T ValueType;
+    typedef T Type;
+
+    static constexpr T kMax = std::numeric_limits<T>::max();
+
+    static T Load(Type const& counter) noexcept
     {
       return counter;
     }
 
     static void Increment(Type& counter) noexcept
     {
+      if (Overflow != CounterOverflow::Wrap && counter == kMax) {
+        if (Overflow == CounterOverflow::Saturate)
+          return;
+        detail::CounterOverflowed();
+      }
       ++counter;
     }
 
-    static unsigned int Decrement(Type& counter) noexcept
+    static T Decrement(Type& counter) noexcept
     {
+      if (Overflow == CounterOverflow::Saturate && counter == kMax)
+        return counter;
+      if (Overflow == CounterOverflow::Terminate && counter == 0)
+        detail::CounterOverflowed();
       return --counter;
     }
+
+    static void Increment(Type& counter, T n) noexcept
+    {
+      if (Overflow != CounterOverflow::Wrap && counter > kMax - n) {
+        if (Overflow == CounterOverflow::Saturate) {
+          counter = kMax;
+          return;
+        }
+        detail::CounterOverflowed();
+      }
+      counter = static_cast<T>(counter + n);
+    }
+
+    static T Decrement(Type& counter, T n) noexcept
+    {
+      if (Overflow == CounterOverflow::Saturate && counter == kMax)
+        return counter;
+      if (Overflow == CounterOverflow::Terminate && counter < n)
+        detail::CounterOverflowed();
+      counter = static_cast<T>(counter - n);
+      return counter;
+    }
+
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      if (counter == 0)
+        return false;
+      Increment(counter);
+      return true;
+    }
+  };
+
+  template<typename T, CounterOverflow Overflow = CounterOverflow::Wrap>
+  struct BasicThreadSafeCounter
+  {
+    static_assert(std::is_unsigned<T>::value, "counter type must be unsigned");
+
+    typedef T ValueType;
+    typedef std::atomic<T> Type;
+
+    static constexpr T kMax = std::numeric_limits<T>::max();
+
+    static T Load(Type const& counter) noexcept
+    {
+      return counter.load(std::memory_order_acquire);
+    }
+
+    // A new reference is always made from an existing one, so the increment
+    // needs no ordering of its own.
+    static void Increment(Type& counter) noexcept
+    {
+      if (Overflow == CounterOverflow::Saturate) {
+        T current = counter.load(std::memory_order_relaxed);
+        while (current != kMax && !counter.compare_exchange_weak(current, static_cast<T>(current + 1), std::memory_order_relaxed)) {}
+      } else if (counter.fetch_add(1, std::memory_order_relaxed) == kMax && Overflow == CounterOverflow::Terminate) {
+        detail::CounterOverflowed();
+      }
+    }
+
+    // Every release publishes the writes made through the dropped reference;
+    // only the thread that takes the count to zero acquires them before the
+    // object is destroyed.
+    static T Decrement(Type& counter) noexcept
+    {
+      T result;
+      if (Overflow == CounterOverflow::Saturate) {
+        T current = counter.load(std::memory_order_relaxed);
+        do {
+          if (current == kMax)
+            return current;
+        } while (!counter.compare_exchange_weak(current, static_cast<T>(current - 1), detail::kReleaseDecrement, std::memory_order_relaxed));
+        result = static_cast<T>(current - 1);
+      } else {
+        T previous = counter.fetch_sub(1, detail::kReleaseDecrement);
+        if (Overflow == CounterOverflow::Terminate && previous == 0)
+          detail::CounterOverflowed();
+        result = static_cast<T>(previous - 1);
+      }
+      if (result == 0)
+        detail::AcquireLastRelease();
+      return result;
+    }
+
+    static void Increment(Type& counter, T n) noexcept
+    {
+      if (Overflow == CounterOverflow::Saturate) {
+        T current = counter.load(std::memory_order_relaxed);
+        while (current != kMax && !counter.compare_exchange_weak(current, current > kMax - n ? kMax : static_cast<T>(current + n), std::memory_order_relaxed)) {}
+      } else if (counter.fetch_add(n, std::memory_order_relaxed) > kMax - n && Overflow == CounterOverflow::Terminate) {
+        detail::CounterOverflowed();
+      }
+    }
+
+    static T Decrement(Type& counter, T n) noexcept
+    {
+      T result;
+      if (Overflow == CounterOverflow::Saturate) {
+        T current = counter.load(std::memory_order_relaxed);
+        do {
+          if (current == kMax)
+            return current;
+        } while (!counter.compare_exchange_weak(current, static_cast<T>(current - n), detail::kReleaseDecrement, std::memory_order_relaxed));
+        result = static_cast<T>(current - n);
+      } else {
+        T previous = counter.fetch_sub(n, detail::kReleaseDecrement);
+        if (Overflow == CounterOverflow::Terminate && previous < n)
+          detail::CounterOverflowed();
+        result = static_cast<T>(previous - n);
+      }
+      if (result == 0)
+        detail::AcquireLastRelease();
+      return result;
+    }
+
+    // Never moves the counter off zero, so an object that is already being
+    // destroyed can not be brought back.
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      T current = counter.load(std::memory_order_relaxed);
+      do {
+        if (current == 0)
+          return false;
+        if (Overflow != CounterOverflow::Wrap && current == kMax) {
+          if (Overflow == CounterOverflow::Saturate)
+            return true;
+          detail::CounterOverflowed();
+        }
+      } while (!counter.compare_exchange_weak(current, static_cast<T>(current + 1), std::memory_order_relaxed));
+      return true;
+    }
+  };
+
+  struct ThreadUnsafeCounter
+    : BasicThreadUnsafeCounter<unsigned int>
+  {
   };
 
   struct ThreadSafeCounter
+    : BasicThreadSafeCounter<unsigned int>
+  {
+  };
+
+  // Fixed-width policies. A 16-bit count saves memory on large numbers of
+  // small objects when the derived fields fit in the padding after it; a
+  // 64-bit count suits objects shared by very many owners.
+  typedef BasicThreadUnsafeCounter<std::uint16_t> ThreadUnsafeCounter16;
+  typedef BasicThreadUnsafeCounter<std::uint32_t> ThreadUnsafeCounter32;
+  typedef BasicThreadUnsafeCounter<std::uint64_t> ThreadUnsafeCounter64;
+  typedef BasicThreadSafeCounter<std::uint16_t> ThreadSafeCounter16;
+  typedef BasicThreadSafeCounter<std::uint32_t> ThreadSafeCounter32;
+  typedef BasicThreadSafeCounter<std::uint64_t> ThreadSafeCounter64;
+
+  template<typename T> using SaturatingThreadUnsafeCounter = BasicThreadUnsafeCounter<T, CounterOverflow::Saturate>;
+  template<typename T> using SaturatingThreadSafeCounter = BasicThreadSafeCounter<T, CounterOverflow::Saturate>;
+  template<typename T> using CheckedThreadUnsafeCounter = BasicThreadUnsafeCounter<T, CounterOverflow::Terminate>;
+  template<typename T> using CheckedThreadSafeCounter = BasicThreadSafeCounter<T, CounterOverflow::Terminate>;
+
+  // Assumed destructive interference size, 64 bytes on x86-64 and most ARM
+  // cores.
+  constexpr std::size_t kCacheLineSize = 64;
+
+  // An atomic policy with the count aligned and padded to Alignment bytes.
+  // With kCacheLineSize the count gets a cache line of its own, so threads
+  // copying references stop invalidating the line that holds the vptr and
+  // the first fields of the object, at the cost of up to two extra lines per
+  // object. ThreadSafeCounter itself is the packed layout.
+  template<std::size_t Alignment, typename CounterPolicy = ThreadSafeCounter>
+  struct AlignedThreadSafeCounter
+    : CounterPolicy
+  {
+    struct alignas(Alignment) Type
+      : CounterPolicy::Type
+    {
+      Type(typename CounterPolicy::ValueType value) noexcept
+        : CounterPolicy::Type(value)
+      {
+      }
+    };
+  };
+
+  typedef AlignedThreadSafeCounter<kCacheLineSize> CacheAlignedCounter;
+  typedef ThreadSafeCounter PackedThreadSafeCounter;
+
+  namespace detail
+  {
+    template<typename T>
+    T LoadRelaxed(std::atomic<T> const& counter) noexcept
+    {
+      return counter.load(std::memory_order_relaxed);
+    }
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    T LoadRelaxed(T const& counter) noexcept
+    {
+      return counter;
+    }
+  } // namespace detail
+
+  // Selects the constructors of RefCounter and RefCounterBase that make an
+  // immortal object, see ImmortalCounter.
+  struct ImmortalTag
+  {
+    explicit ImmortalTag() = default;
+  };
+
+  inline constexpr ImmortalTag kImmortal{};
+
+  // Immortal objects in the manner of CPython 3.12. An object constructed
+  // with kImmortal starts at kImmortalCount, and every operation that finds
+  // the count there returns without writing it: copies of references to a
+  // process-lifetime singleton leave its cache line shared between cores,
+  // and OnFinalDestroy never runs. Mortal objects of the policy pay a relaxed
+  // load and a branch per operation. A mortal count that grows to
+  // kImmortalCount makes the object immortal, i.e. leaks it. Compilers can
+  // not tell that the delete in the default OnFinalDestroy is unreachable
+  // for a static instance and may warn about it; override it to silence
+  // them.
+  template<typename CounterPolicy = ThreadSafeCounter>
+  struct ImmortalCounter
+    : CounterPolicy
+  {
+    typedef typename CounterPolicy::Type Type;
+    typedef typename CounterPolicy::ValueType ValueType;
+
+    static constexpr ValueType kImmortalCount = static_cast<ValueType>(CounterPolicy::kMax / 2 + 1);
+
+    static bool IsImmortal(Type const& counter) noexcept
+    {
+      return detail::LoadRelaxed(counter) >= kImmortalCount;
+    }
+
+    static void Increment(Type& counter) noexcept
+    {
+      if (!IsImmortal(counter))
+        CounterPolicy::Increment(counter);
+    }
+
+    static ValueType Decrement(Type& counter) noexcept
+    {
+      ValueType current = detail::LoadRelaxed(counter);
+      return current >= kImmortalCount ? current : CounterPolicy::Decrement(counter);
+    }
+
+    static void Increment(Type& counter, ValueType n) noexcept
+    {
+      if (!IsImmortal(counter))
+        CounterPolicy::Increment(counter, n);
+    }
+
+    static ValueType Decrement(Type& counter, ValueType n) noexcept
+    {
+      ValueType current = detail::LoadRelaxed(counter);
+      return current >= kImmortalCount ? current : CounterPolicy::Decrement(counter, n);
+    }
+
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      return IsImmortal(counter) || CounterPolicy::IncrementIfNonZero(counter);
+    }
+  };
+
+  // Biased reference counting: the thread that constructs the object counts
+  // in a plain integer, every other thread in an atomic shared counter. When
+  // the owner's count drops to zero it merges into the shared counter and
+  // from then on all threads use the shared counter.
+  //
+  // A reference taken on the owner thread may be dropped elsewhere. When a
+  // non-owner sees the shared count reach zero or below before the merge it
+  // queues the object on the owner thread, which merges it during its next
+  // Decrement, in ProcessQueuedMerges or when it exits, and destroys the
+  // object if nothing is left. Load is exact on the owner thread and after
+  // the merge, a lower bound elsewhere.
+  //
+  // Each unmerged object holds a reference to its owner's record. A thread
+  // queuing an object pins the owner field while it takes a reference of its
+  // own; a merge in that window hands the object's reference to it instead
+  // of releasing it, so the owner can not free the record underneath it.
+  struct BiasedCounter
   {
-    typedef std::atomic<unsigned int> Type;
+    typedef unsigned int ValueType;
+    class Type;
+
+  private:
+    class Record
+    {
+    public:
+      std::atomic<Type*> queue{ nullptr };
+      std::atomic<bool> dead{ false };
+      std::atomic<unsigned int> refs{ 1 };
+
+      void AddRef() noexcept {
+        refs.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void Release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          delete this;
+      }
+    };
+
+    class RecordHolder
+    {
+    public:
+      Record* const record = new Record;
+
+      ~RecordHolder() {
+        record->dead.store(true, std::memory_order_seq_cst);
+        Drain(*record);
+        record->Release();
+      }
+    };
+
+  public:
+    class Type
+    {
+    public:
+      explicit Type(unsigned int initial)
+        : owner(reinterpret_cast<std::uintptr_t>(CurrentRecord()))
+        , biased(initial)
+        , shared(0)
+      {
+        OwnerRecord(owner.load(std::memory_order_relaxed))->AddRef();
+      }
+
+      Type(Type const&) = delete;
+      Type& operator= (Type const&) = delete;
+
+      ~Type() {
+        Record* record = OwnerRecord(owner.load(std::memory_order_relaxed));
+        if (record != nullptr)
+          record->Release();
+      }
+
+    private:
+      friend struct BiasedCounter;
+
+      // The owner's Record, 0 once merged, plus kPinned.
+      std::atomic<std::uintptr_t> owner;
+      unsigned int biased;
+      // Shared count in units of kOne plus the kMerged and kQueued flags.
+      std::atomic<long long> shared;
+      Type* next_queued = nullptr;
+      void* object = nullptr;
+      void (*final_release)(void*) = nullptr;
+    };
+
+    static void Bind(Type& counter, void* object, void (*final_release)(void*)) noexcept
+    {
+      counter.object = object;
+      counter.final_release = final_release;
+    }
 
     static unsigned int Load(Type const& counter) noexcept
     {
-      return counter.load();
+      long long shared = counter.shared.load(std::memory_order_acquire);
+      long long count = Count(shared);
+      if (IsOwner(counter))
+        count += counter.biased;
+      else if ((shared & kMerged) == 0 && count < 1)
+        count = 1;
+      return count < 0 ? 0 : static_cast<unsigned int>(count);
+    }
+
+    // Exact on the owner thread and after the merge. Before the merge a
+    // non-owner can not tell whether the owner still holds references and
+    // answers false.
+    static bool IsUnique(Type const& counter) noexcept
+    {
+      long long shared = counter.shared.load(std::memory_order_acquire);
+      if (IsOwner(counter))
+        return Count(shared) + counter.biased == 1;
+      return (shared & kMerged) != 0 && Count(shared) == 1;
+    }
+
+    static void Increment(Type& counter) noexcept
+    {
+      if (IsOwner(counter))
+        ++counter.biased;
+      else
+        counter.shared.fetch_add(kOne, std::memory_order_relaxed);
+    }
+
+    static unsigned int Decrement(Type& counter) noexcept
+    {
+      Record* record = CurrentRecord();
+      if (record->queue.load(std::memory_order_relaxed) != nullptr)
+        Drain(*record);
+      if (OwnerRecord(counter.owner.load(std::memory_order_relaxed)) == record) {
+        if (--counter.biased != 0)
+          return counter.biased;
+        return SharedResult(Merge(counter));
+      }
+      // The decrement and the decision to queue are one atomic step: once the
+      // reference is gone only a set kQueued keeps the object alive.
+      long long current = counter.shared.load(std::memory_order_relaxed);
+      long long result;
+      do {
+        result = current - kOne;
+        if ((result & (kMerged | kQueued)) == 0 && Count(result) <= 0)
+          result |= kQueued;
+      } while (!counter.shared.compare_exchange_weak(current, result, std::memory_order_acq_rel, std::memory_order_relaxed));
+      if ((result & kQueued) != 0 && (current & kQueued) == 0)
+        return RequestMerge(counter);
+      return SharedResult(result);
+    }
+
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      if (IsOwner(counter)) {
+        if (counter.biased == 0 && Count(counter.shared.load(std::memory_order_relaxed)) <= 0)
+          return false;
+        ++counter.biased;
+        return true;
+      }
+      long long current = counter.shared.load(std::memory_order_relaxed);
+      do {
+        if ((current & kMerged) != 0 && Count(current) == 0)
+          return false;
+      } while (!counter.shared.compare_exchange_weak(current, current + kOne, std::memory_order_relaxed));
+      return true;
+    }
+
+    // Merges the objects other threads have queued on the calling thread.
+    // Long-lived threads that rarely release references can call this from
+    // their event loop.
+    static void ProcessQueuedMerges()
+    {
+      Drain(*CurrentRecord());
+    }
+
+  private:
+    static constexpr long long kMerged = 1;
+    static constexpr long long kQueued = 2;
+    static constexpr int kCountShift = 2;
+    static constexpr long long kOne = 1LL << kCountShift;
+    static constexpr std::uintptr_t kPinned = 1;
+    static_assert(alignof(Record) > kPinned, "kPinned is a spare bit of the Record pointer");
+
+    static constexpr long long Count(long long shared) noexcept
+    {
+      return shared >> kCountShift;
+    }
+
+    static Record* CurrentRecord() {
+      static thread_local RecordHolder holder;
+      return holder.record;
+    }
+
+    static Record* OwnerRecord(std::uintptr_t owner) noexcept
+    {
+      return reinterpret_cast<Record*>(owner & ~kPinned);
+    }
+
+    static bool IsOwner(Type const& counter) noexcept
+    {
+      return OwnerRecord(counter.owner.load(std::memory_order_relaxed)) == CurrentRecord();
+    }
+
+    // The object is alive until it is merged. A queued object is destroyed by
+    // the thread draining the queue.
+    static unsigned int SharedResult(long long shared) noexcept
+    {
+      if ((shared & kMerged) == 0)
+        return 1;
+      long long count = Count(shared);
+      if (count != 0)
+        return static_cast<unsigned int>(count);
+      if ((shared & kQueued) != 0)
+        return 1;
+      detail::AcquireLastRelease();
+      return 0;
+    }
+
+    // Runs on the owner thread, or on any thread once the owner has exited.
+    // The object's reference to the record goes to the pinning thread if
+    // there is one.
+    static long long Merge(Type& counter) noexcept
+    {
+      long long add = static_cast<long long>(counter.biased) * kOne + kMerged;
+      counter.biased = 0;
+      std::uintptr_t owner = counter.owner.exchange(0, std::memory_order_acq_rel);
+      long long result = counter.shared.fetch_add(add, std::memory_order_acq_rel) + add;
+      if ((owner & kPinned) == 0)
+        OwnerRecord(owner)->Release();
+      return result;
+    }
+
+    // Hands an object this thread has just marked kQueued to its owner. If the
+    // owner merged in the meantime the flag is cleared here instead. kQueued
+    // keeps the object alive until it is pushed, and is set once per object,
+    // so only one thread ever pins it.
+    static unsigned int RequestMerge(Type& counter)
+    {
+      std::uintptr_t owner = counter.owner.load(std::memory_order_acquire);
+      do {
+        if (owner == 0)
+          return SharedResult(counter.shared.fetch_and(~kQueued, std::memory_order_acq_rel) & ~kQueued);
+      } while (!counter.owner.compare_exchange_weak(owner, owner | kPinned, std::memory_order_acq_rel, std::memory_order_acquire));
+      Record* record = OwnerRecord(owner);
+      record->AddRef();
+      std::uintptr_t pinned = owner | kPinned;
+      if (!counter.owner.compare_exchange_strong(pinned, owner, std::memory_order_acq_rel, std::memory_order_relaxed))
+        record->Release();
+      Type* head = record->queue.load(std::memory_order_relaxed);
+      do {
+        counter.next_queued = head;
+      } while (!record->queue.compare_exchange_weak(head, &counter, std::memory_order_seq_cst));
+      if (record->dead.load(std::memory_order_seq_cst))
+        Drain(*record);
+      record->Release();
+      return 1;
+    }
+
+    static void Drain(Record& record)
+    {
+      Type* counter = record.queue.exchange(nullptr, std::memory_order_acq_rel);
+      while (counter != nullptr) {
+        Type* next = counter->next_queued;
+        if (counter->owner.load(std::memory_order_relaxed) != 0)
+          Merge(*counter);
+        long long result = counter->shared.fetch_and(~kQueued, std::memory_order_acq_rel) & ~kQueued;
+        if (SharedResult(result) == 0 && counter->final_release != nullptr)
+          counter->final_release(counter->object);
+        counter = next;
+      }
+    }
+  };
+
+  namespace detail
+  {
+    template<typename...> struct MakeVoid { typedef void type; };
+
+    // Policies that can reach zero outside of Decrement (see BiasedCounter)
+    // provide Bind to learn how to destroy the object.
+    template<typename CounterPolicy, typename = void>
+    struct CounterBinder
+    {
+      static void Bind(typename CounterPolicy::Type&, void*, void (*)(void*)) noexcept {}
+    };
+
+    template<typename CounterPolicy>
+    struct CounterBinder<CounterPolicy, typename MakeVoid<decltype(CounterPolicy::Bind(std::declval<typename CounterPolicy::Type&>(), nullptr, nullptr))>::type>
+    {
+      static void Bind(typename CounterPolicy::Type& counter, void* object, void (*final_release)(void*)) noexcept
+      {
+        CounterPolicy::Bind(counter, object, final_release);
+      }
+    };
+  } // namespace detail
+
+  namespace detail
+  {
+    // Policies may provide Increment(counter, n) and Decrement(counter, n) to
+    // adjust a count in one step; otherwise the single steps are repeated.
+    template<typename CounterPolicy, typename = void>
+    struct CounterBulk
+    {
+      typedef decltype(CounterPolicy::Load(std::declval<typename CounterPolicy::Type const&>())) CountType;
+
+      static void Increment(typename CounterPolicy::Type& counter, CountType n) noexcept
+      {
+        for (; n > 0; --n)
+          CounterPolicy::Increment(counter);
+      }
+
+      static CountType Decrement(typename CounterPolicy::Type& counter, CountType n) noexcept
+      {
+        CountType result = 0;
+        for (; n > 0; --n)
+          result = CounterPolicy::Decrement(counter);
+        return result;
+      }
+    };
+
+    template<typename CounterPolicy>
+    struct CounterBulk<CounterPolicy, typename MakeVoid<decltype(CounterPolicy::Decrement(std::declval<typename CounterPolicy::Type&>(), CounterPolicy::Load(std::declval<typename CounterPolicy::Type const&>())))>::type>
+    {
+      typedef decltype(CounterPolicy::Load(std::declval<typename CounterPolicy::Type const&>())) CountType;
+
+      static void Increment(typename CounterPolicy::Type& counter, CountType n) noexcept
+      {
+        CounterPolicy::Increment(counter, n);
+      }
+
+      static CountType Decrement(typename CounterPolicy::Type& counter, CountType n) noexcept
+      {
+        return CounterPolicy::Decrement(counter, n);
+      }
+    };
+
+    // Policies whose Load is not exact on every thread provide IsUnique(counter),
+    // true only when the caller's reference is known to be the only one.
+    template<typename CounterPolicy, typename = void>
+    struct CounterUnique
+    {
+      static bool IsUnique(typename CounterPolicy::Type const& counter) noexcept
+      {
+        return CounterPolicy::Load(counter) == 1;
+      }
+    };
+
+    template<typename CounterPolicy>
+    struct CounterUnique<CounterPolicy, typename MakeVoid<decltype(CounterPolicy::IsUnique(std::declval<typename CounterPolicy::Type const&>()))>::type>
+    {
+      static bool IsUnique(typename CounterPolicy::Type const& counter) noexcept
+      {
+        return CounterPolicy::IsUnique(counter);
+      }
+    };
+  } // namespace detail
+
+  // Receives the final releases made on a thread while it is installed there,
+  // see DeferredReleaseScope in ref_counter_reclaim.h.
+  class DeferredReleaseSink
+  {
+  public:
+    virtual void Defer(void* object, void (*final_release)(void*)) = 0;
+
+  protected:
+    ~DeferredReleaseSink() = default;
+  };
+
+  namespace detail
+  {
+    inline DeferredReleaseSink*& CurrentDeferredReleaseSink() noexcept {
+      static thread_local DeferredReleaseSink* sink = nullptr;
+      return sink;
+    }
+  } // namespace detail
+
+  // References handed over by ReleaseChildren. The outermost final release
+  // on a thread drops them one at a time, so a chain or tree whose nodes
+  // pass their children on is destroyed with constant stack depth instead
+  // of one destructor frame per node. With a step limit at most that many
+  // references are dropped per final release; the rest stay pending until
+  // the next final release on the thread, Run, or thread exit.
+  // Add runs on final release paths that callers expect not to throw: if the
+  // list can not grow, the child is dropped on the spot instead, recursively.
+  // Final releases that run during thread exit after the thread's worklist
+  // is destroyed use a local worklist per object instead, see TornDown.
+  class ReleaseWorklist
+  {
+  public:
+    ReleaseWorklist() = default;
+
+    ReleaseWorklist(ReleaseWorklist const&) = delete;
+    ReleaseWorklist& operator= (ReleaseWorklist const&) = delete;
+
+    ~ReleaseWorklist() {
+      m_running = true;
+      while (!m_pending.empty())
+        DropNext();
+      if (m_thread_worklist)
+        TornDownFlag() = true;
+    }
+
+    // Must not be called once TornDown() is true.
+    static ReleaseWorklist& Current() noexcept {
+      static thread_local ReleaseWorklist worklist(true);
+      return worklist;
+    }
+
+    // True once the calling thread's worklist has been destroyed. The flag
+    // is trivially destructible, so it can be read during the rest of thread
+    // exit.
+    static bool TornDown() noexcept {
+      return TornDownFlag();
+    }
+
+    // Takes the reference held by child, a RefCounterPtr or anything else
+    // with Detach().
+    template<class Pointer>
+    void Add(Pointer&& child) {
+      auto* object = child.Detach();
+      if (object == nullptr)
+        return;
+      Entry entry{ object, &Drop<typename std::remove_pointer<decltype(object)>::type> };
+      if (m_pending.size() == m_pending.capacity() && !Grow()) {
+        entry.drop(entry.object);
+        return;
+      }
+      m_pending.push_back(entry);
+    }
+
+    std::size_t Pending() const noexcept {
+      return m_pending.size();
+    }
+
+    void SetStepLimit(std::size_t max_releases) noexcept {
+      m_step_limit = max_releases;
+    }
+
+    std::size_t StepLimit() const noexcept {
+      return m_step_limit;
+    }
+
+    // Drops up to max_releases pending references and returns how many.
+    std::size_t Run(std::size_t max_releases = std::numeric_limits<std::size_t>::max()) {
+      if (m_running)
+        return 0;
+      m_running = true;
+      std::size_t released = 0;
+      while (released < max_releases && !m_pending.empty()) {
+        DropNext();
+        ++released;
+      }
+      m_running = false;
+      return released;
+    }
+
+    // Called after every final release.
+    void Step() {
+      if (!m_pending.empty())
+        Run(m_step_limit);
+    }
+
+  private:
+    struct Entry
+    {
+      void* object;
+      void (*drop)(void*);
+    };
+
+    explicit ReleaseWorklist(bool thread_worklist) noexcept
+      : m_thread_worklist(thread_worklist)
+    {
+    }
+
+    static bool& TornDownFlag() noexcept {
+      static thread_local bool torn_down = false;
+      return torn_down;
+    }
+
+    template<class T>
+    static void Drop(void* object) {
+      static_cast<T*>(object)->Decrement();
+    }
+
+    bool Grow() noexcept {
+      try {
+        m_pending.reserve(m_pending.empty() ? 16 : m_pending.capacity() * 2);
+        return true;
+      } catch (std::bad_alloc const&) {
+        return false;
+      }
+    }
+
+    void DropNext() {
+      Entry entry = m_pending.back();
+      m_pending.pop_back();
+      entry.drop(entry.object);
+    }
+
+    std::vector<Entry> m_pending;
+    std::size_t m_step_limit = std::numeric_limits<std::size_t>::max();
+    bool m_running = false;
+    bool m_thread_worklist = false;
+  };
+
+  template<typename CounterPolicy = ThreadSafeCounter>
+  class RefCounter
+  {
+  public:
+    typedef decltype(CounterPolicy::Load(std::declval<typename CounterPolicy::Type const&>())) CountType;
+
+    RefCounter() noexcept
+      : m_ref_counter(0)
+    {
+      detail::CounterBinder<CounterPolicy>::Bind(m_ref_counter, this, &RefCounter::FinalRelease);
+    }
+
+    RefCounter(RefCounter const&) noexcept
+      : m_ref_counter(0)
+    {
+      detail::CounterBinder<CounterPolicy>::Bind(m_ref_counter, this, &RefCounter::FinalRelease);
+    }
+
+    // An immortal object, for policies that have them such as
+    // ImmortalCounter. Constant-initialized where the count type allows, so
+    // a static instance is usable before dynamic initialization.
+    template<typename Policy = CounterPolicy, typename = decltype(Policy::kImmortalCount)>
+    constexpr explicit RefCounter(ImmortalTag) noexcept
+      : m_ref_counter(Policy::kImmortalCount)
+    {
+    }
+
+    RefCounter& operator= (RefCounter const&) noexcept { return *this; }
+
+    void Increment() noexcept {
+      CounterPolicy::Increment(m_ref_counter);
+    }
+
+    void Decrement() {
+      if (CounterPolicy::Decrement(m_ref_counter) == 0)
+        DestroyOrDefer();
+    }
+
+    // Adds or drops n references in one step, see RefCounterPtrVector.
+    void Increment(CountType n) noexcept {
+      detail::CounterBulk<CounterPolicy>::Increment(m_ref_counter, n);
+    }
+
+    void Decrement(CountType n) {
+      if (n != 0 && detail::CounterBulk<CounterPolicy>::Decrement(m_ref_counter, n) == 0)
+        DestroyOrDefer();
+    }
+
+    [[nodiscard]] bool TryIncrement() noexcept {
+      return CounterPolicy::IncrementIfNonZero(m_ref_counter);
+    }
+
+    CountType UseCount() const noexcept {
+      return CounterPolicy::Load(m_ref_counter);
+    }
+
+    // True only when the caller's reference is the only one. Unlike
+    // UseCount() == 1 it never guesses for policies whose count is a lower
+    // bound on some threads, see BiasedCounter.
+    bool IsUnique() const noexcept {
+      return detail::CounterUnique<CounterPolicy>::IsUnique(m_ref_counter);
+    }
+
+    // For policies that only detect zero after a mode switch, see
+    // ShardedCounter. The caller must hold a reference.
+    template<typename Policy = CounterPolicy>
+    auto Kill() noexcept -> decltype(Policy::Kill(std::declval<typename Policy::Type&>()))
+    {
+      return CounterPolicy::Kill(m_ref_counter);
+    }
+
+  protected:
+    virtual ~RefCounter() = default;
+
+    virtual void OnFinalDestroy() {
+      delete this;
+    }
+
+    // Called before OnFinalDestroy. Override to move owning members into
+    // children (e.g. `children.Add(m_next)`) so that destroying a long chain
+    // does not recurse through the destructors.
+    virtual void ReleaseChildren(ReleaseWorklist& children) {
+      (void)children;
+    }
+
+  private:
+    void DestroyOrDefer() {
+      if (DeferredReleaseSink* sink = detail::CurrentDeferredReleaseSink())
+        sink->Defer(this, &RefCounter::FinalRelease);
+      else
+        Destroy();
+    }
+
+    void Destroy() {
+      if (ReleaseWorklist::TornDown()) {
+        // Late in thread exit: the children are dropped when the local
+        // worklist goes out of scope.
+        ReleaseWorklist children;
+        ReleaseChildren(children);
+        OnFinalDestroy();
+        return;
+      }
+      ReleaseWorklist& worklist = ReleaseWorklist::Current();
+      ReleaseChildren(worklist);
+      OnFinalDestroy();
+      worklist.Step();
+    }
+
+    static void FinalRelease(void* object) {
+      static_cast<RefCounter*>(object)->Destroy();
+    }
+
+    typedef typename CounterPolicy::Type CounterType;
+    CounterType m_ref_counter;
+  };
+
+  // Non-virtual reference counting for types that need no polymorphism:
+  // no vptr, and the increment, decrement and destruction are resolved at
+  // compile time. The final release calls Derived::OnFinalDestroy, which
+  // defaults to deleting the object as a Derived. Derived makes its
+  // destructor, and any OnFinalDestroy of its own, accessible to its
+  // RefCounterBase, either publicly or by befriending it. Use RefCounter for
+  // interface hierarchies.
+  template<class Derived, typename CounterPolicy = ThreadSafeCounter>
+  class RefCounterBase
+  {
+  public:
+    typedef decltype(CounterPolicy::Load(std::declval<typename CounterPolicy::Type const&>())) CountType;
+
+    void Increment() noexcept {
+      CounterPolicy::Increment(m_ref_counter);
+    }
+
+    void Decrement() {
+      if (CounterPolicy::Decrement(m_ref_counter) == 0)
+        DestroyOrDefer();
+    }
+
+    void Increment(CountType n) noexcept {
+      detail::CounterBulk<CounterPolicy>::Increment(m_ref_counter, n);
+    }
+
+    void Decrement(CountType n) {
+      if (n != 0 && detail::CounterBulk<CounterPolicy>::Decrement(m_ref_counter, n) == 0)
+        DestroyOrDefer();
+    }
+
+    [[nodiscard]] bool TryIncrement() noexcept {
+      return CounterPolicy::IncrementIfNonZero(m_ref_counter);
+    }
+
+    CountType UseCount() const noexcept {
+      return CounterPolicy::Load(m_ref_counter);
+    }
+
+    // See RefCounter.
+    bool IsUnique() const noexcept {
+      return detail::CounterUnique<CounterPolicy>::IsUnique(m_ref_counter);
+    }
+
+    // For policies that only detect zero after a mode switch, see
+    // ShardedCounter. The caller must hold a reference.
+    template<typename Policy = CounterPolicy>
+    auto Kill() noexcept -> decltype(Policy::Kill(std::declval<typename Policy::Type&>()))
+    {
+      return CounterPolicy::Kill(m_ref_counter);
+    }
+
+  protected:
+    RefCounterBase() noexcept
+      : m_ref_counter(0)
+    {
+      detail::CounterBinder<CounterPolicy>::Bind(m_ref_counter, this, &RefCounterBase::FinalRelease);
+    }
+
+    RefCounterBase(RefCounterBase const&) noexcept
+      : m_ref_counter(0)
+    {
+      detail::CounterBinder<CounterPolicy>::Bind(m_ref_counter, this, &RefCounterBase::FinalRelease);
+    }
+
+    // See RefCounter.
+    template<typename Policy = CounterPolicy, typename = decltype(Policy::kImmortalCount)>
+    constexpr explicit RefCounterBase(ImmortalTag) noexcept
+      : m_ref_counter(Policy::kImmortalCount)
+    {
+    }
+
+    RefCounterBase& operator= (RefCounterBase const&) noexcept { return *this; }
+
+    ~RefCounterBase() = default;
+
+    void OnFinalDestroy() {
+      delete static_cast<Derived*>(this);
+    }
+
+    // Hidden by Derived to hand its children over, see RefCounter.
+    void ReleaseChildren(ReleaseWorklist& children) {
+      (void)children;
+    }
+
+  private:
+    void DestroyOrDefer() {
+      if (DeferredReleaseSink* sink = detail::CurrentDeferredReleaseSink())
+        sink->Defer(this, &RefCounterBase::FinalRelease);
+      else
+        Destroy();
+    }
+
+    void Destroy() {
+      if (ReleaseWorklist::TornDown()) {
+        // See RefCounter::Destroy.
+        ReleaseWorklist children;
+        static_cast<Derived*>(this)->ReleaseChildren(children);
+        static_cast<Derived*>(this)->OnFinalDestroy();
+        return;
+      }
+      ReleaseWorklist& worklist = ReleaseWorklist::Current();
+      static_cast<Derived*>(this)->ReleaseChildren(worklist);
+      static_cast<Derived*>(this)->OnFinalDestroy();
+      worklist.Step();
+    }
+
+    static void FinalRelease(void* object) {
+      static_cast<RefCounterBase*>(object)->Destroy();
+    }
+
+    typedef typename CounterPolicy::Type CounterType;
+    CounterType m_ref_counter;
+  };
+
+  // Side block shared by an object and its weak references. It is created
+  // the first time a weak reference is taken and outlives the object until
+  // the last weak reference is gone.
+  template<typename CounterPolicy>
+  class WeakRefControl
+  {
+  public:
+    explicit WeakRefControl(RefCounter<CounterPolicy>* object) noexcept
+      : m_object(object)
+      , m_lockers(0)
+      , m_weak_count(1)
+    {
+
+    }
+
+    WeakRefControl(WeakRefControl const&) = delete;
+    WeakRefControl& operator= (WeakRefControl const&) = delete;
+
+    void AddWeak() noexcept {
+      m_weak_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void ReleaseWeak() noexcept {
+      if (m_weak_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+    }
+
+    // Takes a strong reference if the object is still alive. A locker that
+    // has announced itself keeps the object's memory from being released
+    // until it is done, see Expire.
+    bool TryLock() noexcept {
+      m_lockers.fetch_add(1, std::memory_order_seq_cst);
+      RefCounter<CounterPolicy>* object = m_object.load(std::memory_order_seq_cst);
+      bool locked = object != nullptr && object->TryIncrement();
+      m_lockers.fetch_sub(1, std::memory_order_release);
+      return locked;
     }
 
-    static void Increment(Type& counter) noexcept
-    {
-      ++counter;
+    bool Expired() noexcept {
+      m_lockers.fetch_add(1, std::memory_order_seq_cst);
+      RefCounter<CounterPolicy>* object = m_object.load(std::memory_order_seq_cst);
+      bool expired = object == nullptr || object->UseCount() == 0;
+      m_lockers.fetch_sub(1, std::memory_order_release);
+      return expired;
     }
 
-    static unsigned int Decrement(Type& counter) noexcept
-    {
-      return --counter;
+    // Called by the object while it is destroyed. Waits for lockers that may
+    // still be looking at its counter, then drops the object's own share.
+    // The store and the loads are seq_cst to pair with TryLock's announce
+    // and load: either a locker is counted here or it reads nullptr.
+    void Expire() noexcept {
+      m_object.store(nullptr, std::memory_order_seq_cst);
+      while (m_lockers.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+      ReleaseWeak();
     }
+
+  private:
+    ~WeakRefControl() = default;
+
+    std::atomic<RefCounter<CounterPolicy>*> m_object;
+    std::atomic<unsigned int> m_lockers;
+    std::atomic<unsigned int> m_weak_count;
   };
 
+  // Base for objects that can be referenced by RefCounterWeakPtr. It only
+  // adds a pointer to RefCounter; the control block itself is allocated on
+  // the first weak reference, so types that do not need weak references
+  // should keep deriving from RefCounter directly.
   template<typename CounterPolicy = ThreadSafeCounter>
-  class RefCounter
+  class WeakRefCounter
+    : public RefCounter<CounterPolicy>
   {
   public:
-    RefCounter() noexcept
-      : m_ref_counter(0)
-    {
-
-    }
+    typedef WeakRefControl<CounterPolicy> WeakControlType;
 
-    RefCounter(RefCounter const&) noexcept
-      : m_ref_counter(0)
+    WeakRefCounter() noexcept
+      : m_weak_control(nullptr)
     {
 
     }
 
-    RefCounter& operator= (RefCounter const&) noexcept { return *this; }
-
-    void Increment() noexcept {
-      CounterPolicy::Increment(m_ref_counter);
-    }
+    WeakRefCounter(WeakRefCounter const&) noexcept
+      : RefCounter<CounterPolicy>()
+      , m_weak_control(nullptr)
+    {
 
-    void Decrement() {
-      if (CounterPolicy::Decrement(m_ref_counter) == 0)
-        OnFinalDestroy();
     }
 
-    unsigned int UseCount() const noexcept {
-      return CounterPolicy::Load(m_ref_counter);
+    WeakRefCounter& operator= (WeakRefCounter const&) noexcept { return *this; }
+
+    // Must be called while holding a strong reference. The returned block
+    // carries one weak reference owned by the caller.
+    WeakControlType* AcquireWeakControl() {
+      WeakControlType* control = m_weak_control.load(std::memory_order_acquire);
+      if (control == nullptr) {
+        WeakControlType* created = new WeakControlType(this);
+        if (m_weak_control.compare_exchange_strong(control, created, std::memory_order_acq_rel, std::memory_order_acquire))
+          control = created;
+        else
+          created->ReleaseWeak();
+      }
+      control->AddWeak();
+      return control;
     }
 
   protected:
-    virtual ~RefCounter() = default;
-
-    virtual void OnFinalDestroy() {
-      delete this;
+    virtual ~WeakRefCounter() {
+      WeakControlType* control = m_weak_control.load(std::memory_order_acquire);
+      if (control != nullptr)
+        control->Expire();
     }
 
   private:
-    typedef typename CounterPolicy::Type CounterType;
-    CounterType m_ref_counter;
+    std::atomic<WeakControlType*> m_weak_control;
   };
 
+  template<class T> class TransferToken;
+
   template<class T>
   class RefCounterPtr
+    : private detail::ReferenceTracker
   {
   private:
     typedef RefCounterPtr ThisType;
@@ -102,31 +1267,34 @@ namespace ref_counter
     {
     }
 
-    RefCounterPtr(T* p, bool add_ref = true) : px(p)
+    REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr(T* p, bool add_ref = true)
+      : RefCounterPtr(p, add_ref, REF_COUNTER_CALL_SITE())
     {
-      if (px != 0 && add_ref) px->Increment();
     }
 
     template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
-    RefCounterPtr(RefCounterPtr<U> const& rhs)
-      : px(rhs.Get())
+    REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr(RefCounterPtr<U> const& rhs)
+      : RefCounterPtr(rhs.Get(), true, REF_COUNTER_CALL_SITE())
     {
-      if (px != 0) px->Increment();
     }
 
-    RefCounterPtr(RefCounterPtr const& rhs) : px(rhs.px)
+    REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr(RefCounterPtr const& rhs)
+      : RefCounterPtr(rhs.px, true, REF_COUNTER_CALL_SITE())
     {
-      if (px != 0) px->Increment();
     }
 
     ~RefCounterPtr()
     {
+      TrackRelease();
       if (px != 0) px->Decrement();
     }
 
-    template<class U> RefCounterPtr& operator=(RefCounterPtr<U> const& rhs)
+    // Assignments that leave the pointee unchanged skip the increment and
+    // decrement the swap would make.
+    template<class U> REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr& operator=(RefCounterPtr<U> const& rhs)
     {
-      ThisType(rhs).swap(*this);
+      if (px != rhs.Get())
+        ThisType(rhs.Get(), true, REF_COUNTER_CALL_SITE()).swap(*this);
       return *this;
     }
 
@@ -134,6 +1302,7 @@ namespace ref_counter
     RefCounterPtr(RefCounterPtr&& rhs) noexcept : px(rhs.px)
     {
       rhs.px = 0;
+      TrackMove(rhs);
     }
 
     RefCounterPtr& operator=(RefCounterPtr&& rhs) noexcept
@@ -149,6 +1318,7 @@ namespace ref_counter
       : px(rhs.px)
     {
       rhs.px = 0;
+      TrackMove(static_cast<detail::ReferenceTracker&>(rhs));
     }
 
     template<class U>
@@ -158,15 +1328,17 @@ namespace ref_counter
       return *this;
     }
 
-    RefCounterPtr& operator=(RefCounterPtr const& rhs)
+    REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr& operator=(RefCounterPtr const& rhs)
     {
-      ThisType(rhs).swap(*this);
+      if (px != rhs.px)
+        ThisType(rhs.px, true, REF_COUNTER_CALL_SITE()).swap(*this);
       return *this;
     }
 
-    RefCounterPtr& operator=(T* rhs)
+    REF_COUNTER_TRACKED_ACQUIRE RefCounterPtr& operator=(T* rhs)
     {
-      ThisType(rhs).swap(*this);
+      if (px != rhs)
+        ThisType(rhs, true, REF_COUNTER_CALL_SITE()).swap(*this);
       return *this;
     }
 
@@ -175,14 +1347,19 @@ namespace ref_counter
       ThisType().swap(*this);
     }
 
-    void Reset(T* rhs)
+    REF_COUNTER_TRACKED_ACQUIRE void Reset(T* rhs)
     {
-      ThisType(rhs).swap(*this);
+      if (px != rhs)
+        ThisType(rhs, true, REF_COUNTER_CALL_SITE()).swap(*this);
     }
 
-    void Reset(T* rhs, bool add_ref)
+    // Adopting a reference to the object already held leaves one of the two.
+    REF_COUNTER_TRACKED_ACQUIRE void Reset(T* rhs, bool add_ref)
     {
-      ThisType(rhs, add_ref).swap(*this);
+      if (px != rhs)
+        ThisType(rhs, add_ref, REF_COUNTER_CALL_SITE()).swap(*this);
+      else if (px != 0 && !add_ref)
+        px->Decrement();
     }
 
     T* Get() const noexcept
@@ -194,9 +1371,17 @@ namespace ref_counter
     {
       T* ret = px;
       px = 0;
+      TrackRelease();
       return ret;
     }
 
+    // Gives up the reference as a token for another thread to Adopt,
+    // without touching the count.
+    [[nodiscard]] TransferToken<T> Release() noexcept
+    {
+      return TransferToken<T>(Detach());
+    }
+
     T& operator*() const noexcept
     {
       assert(px != 0);
@@ -225,12 +1410,115 @@ namespace ref_counter
       T* tmp = px;
       px = rhs.px;
       rhs.px = tmp;
+      TrackSwap(rhs);
     }
 
   private:
+    // call_site is recorded in tracking mode, see REF_COUNTER_CALL_SITE.
+    RefCounterPtr(T* p, bool add_ref, void* call_site) : px(p)
+    {
+      if (px != 0 && add_ref) px->Increment();
+      TrackAcquire(px, call_site);
+    }
+
     T* px;
   };
 
+  // A reference in transit between threads, made by RefCounterPtr::Release
+  // and turned back into a RefCounterPtr by exactly one Adopt. Neither step
+  // touches the count. Move-only and the size of a pointer unless
+  // REF_COUNTER_TRANSFER_CHECKS, which asserts that a token is neither
+  // adopted twice nor dropped unadopted; a dropped token still releases its
+  // reference.
+  template<class T>
+  class [[nodiscard]] TransferToken
+  {
+  public:
+    TransferToken() noexcept = default;
+
+    TransferToken(TransferToken&& rhs) noexcept
+      : px(rhs.px)
+#if REF_COUNTER_TRANSFER_CHECKS
+      , m_consumed(rhs.m_consumed)
+#endif
+    {
+      rhs.px = 0;
+#if REF_COUNTER_TRANSFER_CHECKS
+      rhs.m_consumed = true;
+#endif
+    }
+
+    template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+    TransferToken(TransferToken<U>&& rhs) noexcept
+      : px(rhs.px)
+#if REF_COUNTER_TRANSFER_CHECKS
+      , m_consumed(rhs.m_consumed)
+#endif
+    {
+      rhs.px = 0;
+#if REF_COUNTER_TRANSFER_CHECKS
+      rhs.m_consumed = true;
+#endif
+    }
+
+    TransferToken& operator= (TransferToken&& rhs) noexcept
+    {
+      TransferToken(static_cast<TransferToken&&>(rhs)).swap(*this);
+      return *this;
+    }
+
+    ~TransferToken()
+    {
+#if REF_COUNTER_TRANSFER_CHECKS
+      assert(px == 0 && "TransferToken dropped without Adopt");
+#endif
+      if (px != 0) px->Decrement();
+    }
+
+    [[nodiscard]] RefCounterPtr<T> Adopt() noexcept
+    {
+#if REF_COUNTER_TRANSFER_CHECKS
+      assert(!m_consumed && "TransferToken adopted twice");
+      m_consumed = true;
+#endif
+      T* p = px;
+      px = 0;
+      return RefCounterPtr<T>(p, false);
+    }
+
+    T* Get() const noexcept
+    {
+      return px;
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return px != 0;
+    }
+
+    void swap(TransferToken& rhs) noexcept
+    {
+      std::swap(px, rhs.px);
+#if REF_COUNTER_TRANSFER_CHECKS
+      std::swap(m_consumed, rhs.m_consumed);
+#endif
+    }
+
+  private:
+    template<class U> friend class RefCounterPtr;
+    template<class U> friend class TransferToken;
+
+    explicit TransferToken(T* p) noexcept
+      : px(p)
+    {
+    }
+
+    T* px = 0;
+#if REF_COUNTER_TRANSFER_CHECKS
+    bool m_consumed = false;
+#endif
+  };
+
   template<class T, class U> inline bool operator==(RefCounterPtr<T> const& a, RefCounterPtr<U> const& b) noexcept
   {
     return a.Get() == b.Get();
@@ -324,13 +1612,193 @@ namespace ref_counter
 
   template<class T, class U> RefCounterPtr<T> dynamic_pointer_cast(RefCounterPtr<U>&& p) noexcept
   {
+    // The reference moves over only on success; a failed cast leaves p as
+    // it was. Neither way touches the count.
     T* p2 = dynamic_cast<T*>(p.Get());
+    if (p2 == 0)
+      return RefCounterPtr<T>();
+    static_cast<void>(p.Detach());
+    return RefCounterPtr<T>(p2, false);
+  }
+
+  template<class T, class... Args> RefCounterPtr<T> MakeRef(Args&&... args)
+  {
+    return RefCounterPtr<T>(new T(std::forward<Args>(args)...));
+  }
+
+  // Borrowed reference for parameters of functions that only use an object
+  // for the duration of the call. It converts implicitly from a
+  // RefCounterPtr lvalue, so passing one on costs a pointer copy instead of
+  // a count round trip, and it never holds a count itself: the caller's
+  // reference keeps the object alive. A callee that needs to keep the
+  // object asks for a reference of its own with Share.
+  //
+  // Conversion from an rvalue RefCounterPtr is deleted on purpose. It would
+  // be safe for a call argument, whose temporary lives to the end of the
+  // full expression, but the same conversion also binds a local such as
+  // `RefCounterRef<T> r = MakeRef<T>();` to an object destroyed at the
+  // semicolon, and the two can not be told apart. So `f(MakeRef<T>())` and
+  // `f(std::move(p))` do not compile: name the object first, or give f an
+  // overload taking RefCounterPtr<T> when it is meant to consume one.
+  template<class T>
+  class RefCounterRef
+  {
+  public:
+    constexpr RefCounterRef() noexcept : px(0)
+    {
+    }
+
+    constexpr RefCounterRef(std::nullptr_t) noexcept : px(0)
+    {
+    }
+
+    // p must be kept alive by the caller for as long as the borrow is used,
+    // e.g. `this` inside a member function.
+    explicit RefCounterRef(T* p) noexcept : px(p)
+    {
+    }
+
+    template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+    RefCounterRef(RefCounterPtr<U> const& p) noexcept : px(p.Get())
+    {
+    }
+
+    template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+    RefCounterRef(RefCounterPtr<U>&& p) = delete;
+
+    template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value && !std::is_same<U, T>::value, int>::type = 0>
+    RefCounterRef(RefCounterRef<U> const& rhs) noexcept : px(rhs.Get())
+    {
+    }
+
+    T* Get() const noexcept
+    {
+      return px;
+    }
+
+    T& operator*() const noexcept
+    {
+      assert(px != 0);
+      return *px;
+    }
+
+    T* operator->() const noexcept
+    {
+      assert(px != 0);
+      return px;
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return px != 0;
+    }
+
+    bool operator! () const noexcept
+    {
+      return px == 0;
+    }
+
+    // An owning reference, the only way to extend the lifetime.
+    RefCounterPtr<T> Share() const
+    {
+      return RefCounterPtr<T>(px);
+    }
+
+  private:
+    T* px;
+  };
+
+  template<class T, class U> inline bool operator==(RefCounterRef<T> const& a, RefCounterRef<U> const& b) noexcept
+  {
+    return a.Get() == b.Get();
+  }
+
+  template<class T, class U> inline bool operator!=(RefCounterRef<T> const& a, RefCounterRef<U> const& b) noexcept
+  {
+    return a.Get() != b.Get();
+  }
+
+  template<class T, class U> inline bool operator==(RefCounterRef<T> const& a, RefCounterPtr<U> const& b) noexcept
+  {
+    return a.Get() == b.Get();
+  }
+
+  template<class T, class U> inline bool operator!=(RefCounterRef<T> const& a, RefCounterPtr<U> const& b) noexcept
+  {
+    return a.Get() != b.Get();
+  }
+
+  template<class T, class U> inline bool operator==(RefCounterPtr<T> const& a, RefCounterRef<U> const& b) noexcept
+  {
+    return a.Get() == b.Get();
+  }
+
+  template<class T, class U> inline bool operator!=(RefCounterPtr<T> const& a, RefCounterRef<U> const& b) noexcept
+  {
+    return a.Get() != b.Get();
+  }
+
+  namespace detail
+  {
+    // Class types are inherited so that RefCounterPtr's -> and * reach their
+    // members directly; final and non-class types are held as a member.
+    template<class T, bool Inherit = std::is_class<T>::value && !std::is_final<T>::value>
+    class RefCountedStorage
+      : public T
+    {
+    public:
+      template<class... Args>
+      explicit RefCountedStorage(Args&&... args)
+        : T(std::forward<Args>(args)...)
+      {
+      }
+
+      T& Value() noexcept { return *this; }
+
+      T const& Value() const noexcept { return *this; }
+    };
 
-    RefCounterPtr<T> r(p2, false);
+    template<class T>
+    class RefCountedStorage<T, false>
+    {
+    public:
+      template<class... Args>
+      explicit RefCountedStorage(Args&&... args)
+        : m_value(std::forward<Args>(args)...)
+      {
+      }
+
+      T& Value() noexcept { return m_value; }
+
+      T const& Value() const noexcept { return m_value; }
+
+    private:
+      T m_value;
+    };
+  } // namespace detail
+
+  // Reference counted wrapper for types that do not derive from RefCounter,
+  // created with MakeRefFor. Count and object share one allocation and no
+  // vptr is added. T must not have members named like those of
+  // RefCounterBase.
+  template<class T, typename CounterPolicy = ThreadSafeCounter>
+  class RefCountedObject final
+    : public RefCounterBase<RefCountedObject<T, CounterPolicy>, CounterPolicy>
+    , public detail::RefCountedStorage<T>
+  {
+  public:
+    template<class... Args>
+    explicit RefCountedObject(Args&&... args)
+      : detail::RefCountedStorage<T>(std::forward<Args>(args)...)
+    {
+    }
+  };
 
-    if (p2) p.Detach();
+  template<class T, typename CounterPolicy = ThreadSafeCounter> using RefCounterPtrFor = RefCounterPtr<RefCountedObject<T, CounterPolicy>>;
 
-    return r;
+  template<class T, typename CounterPolicy = ThreadSafeCounter, class... Args> RefCounterPtrFor<T, CounterPolicy> MakeRefFor(Args&&... args)
+  {
+    return RefCounterPtrFor<T, CounterPolicy>(new RefCountedObject<T, CounterPolicy>(std::forward<Args>(args)...));
   }
 
   template<class E, class T, class Y> std::basic_ostream<E, T>& operator<< (std::basic_ostream<E, T>& os, RefCounterPtr<Y> const& p)
@@ -339,6 +1807,103 @@ namespace ref_counter
     return os;
   }
 
+  template<class T>
+  class RefCounterWeakPtr
+  {
+  private:
+    typedef RefCounterWeakPtr ThisType;
+    typedef typename T::WeakControlType ControlType;
+
+  public:
+    constexpr RefCounterWeakPtr() noexcept : px(0), pc(0)
+    {
+    }
+
+    RefCounterWeakPtr(RefCounterPtr<T> const& rhs)
+      : px(rhs.Get())
+      , pc(px != 0 ? px->AcquireWeakControl() : 0)
+    {
+    }
+
+    template<class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+    RefCounterWeakPtr(RefCounterPtr<U> const& rhs)
+      : px(rhs.Get())
+      , pc(px != 0 ? px->AcquireWeakControl() : 0)
+    {
+    }
+
+    RefCounterWeakPtr(RefCounterWeakPtr const& rhs) noexcept : px(rhs.px), pc(rhs.pc)
+    {
+      if (pc != 0) pc->AddWeak();
+    }
+
+    RefCounterWeakPtr(RefCounterWeakPtr&& rhs) noexcept : px(rhs.px), pc(rhs.pc)
+    {
+      rhs.px = 0;
+      rhs.pc = 0;
+    }
+
+    ~RefCounterWeakPtr()
+    {
+      if (pc != 0) pc->ReleaseWeak();
+    }
+
+    RefCounterWeakPtr& operator=(RefCounterWeakPtr const& rhs) noexcept
+    {
+      ThisType(rhs).swap(*this);
+      return *this;
+    }
+
+    RefCounterWeakPtr& operator=(RefCounterWeakPtr&& rhs) noexcept
+    {
+      ThisType(static_cast<RefCounterWeakPtr&&>(rhs)).swap(*this);
+      return *this;
+    }
+
+    template<class U> RefCounterWeakPtr& operator=(RefCounterPtr<U> const& rhs)
+    {
+      ThisType(rhs).swap(*this);
+      return *this;
+    }
+
+    void Reset() noexcept
+    {
+      ThisType().swap(*this);
+    }
+
+    // Returns an empty pointer once the object's count has reached zero.
+    RefCounterPtr<T> Lock() const noexcept
+    {
+      if (pc != 0 && pc->TryLock())
+        return RefCounterPtr<T>(px, false);
+      return RefCounterPtr<T>();
+    }
+
+    bool Expired() const noexcept
+    {
+      return pc == 0 || pc->Expired();
+    }
+
+    void swap(RefCounterWeakPtr& rhs) noexcept
+    {
+      T* tmp = px;
+      px = rhs.px;
+      rhs.px = tmp;
+      ControlType* tmp_control = pc;
+      pc = rhs.pc;
+      rhs.pc = tmp_control;
+    }
+
+  private:
+    T* px;
+    ControlType* pc;
+  };
+
+  template<class T> void swap(RefCounterWeakPtr<T>& lhs, RefCounterWeakPtr<T>& rhs) noexcept
+  {
+    lhs.swap(rhs);
+  }
+
 } // namespace neo
 
 namespace std
@@ -0,0 +1,229 @@
+#ifndef REF_COUNTER_ARENA_H_
+#define REF_COUNTER_ARENA_H_
+
+#include "ref_counter.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#ifndef REF_COUNTER_ARENA_CHECKS
+#ifdef NDEBUG
+#define REF_COUNTER_ARENA_CHECKS 0
+#else
+#define REF_COUNTER_ARENA_CHECKS 1
+#endif
+#endif
+
+namespace ref_counter
+{
+  // Bump-pointer arena for ArenaRefCounter objects. Allocation is not
+  // thread-safe; objects may still be released from any thread as long as
+  // that happens before Reset. With REF_COUNTER_ARENA_CHECKS (on unless
+  // NDEBUG) every allocation carries a header pointing back to the arena so
+  // that Reset can assert that no object is still referenced.
+  class RefCounterArena
+  {
+  public:
+    static constexpr std::size_t kDefaultChunkSize = 64 * 1024;
+    static constexpr std::size_t kAlignment = alignof(std::max_align_t);
+
+    explicit RefCounterArena(std::size_t chunk_size = kDefaultChunkSize) noexcept
+      : m_chunks(nullptr)
+      , m_cursor(nullptr)
+      , m_end(nullptr)
+      , m_chunk_size(chunk_size)
+#if REF_COUNTER_ARENA_CHECKS
+      , m_live_objects(0)
+#endif
+    {
+
+    }
+
+    RefCounterArena(RefCounterArena const&) = delete;
+    RefCounterArena& operator= (RefCounterArena const&) = delete;
+
+    ~RefCounterArena() {
+      Reset();
+      ReleaseChunks(nullptr);
+    }
+
+    void* Allocate(std::size_t size) {
+      std::size_t block_size = RoundUp(kHeaderSize + size);
+      if (static_cast<std::size_t>(m_end - m_cursor) < block_size)
+        AddChunk(block_size);
+      char* block = m_cursor;
+      m_cursor += block_size;
+#if REF_COUNTER_ARENA_CHECKS
+      reinterpret_cast<BlockHeader*>(block)->arena = this;
+      m_live_objects.fetch_add(1, std::memory_order_relaxed);
+#endif
+      return block + kHeaderSize;
+    }
+
+    // Allocation for types aligned beyond kAlignment, e.g. those using
+    // CacheAlignedCounter. The header, if any, directly precedes the object.
+    void* Allocate(std::size_t size, std::size_t alignment) {
+      if (alignment <= kAlignment)
+        return Allocate(size);
+      std::size_t block_size = RoundUp(kHeaderSize + size) + alignment;
+      if (static_cast<std::size_t>(m_end - m_cursor) < block_size)
+        AddChunk(block_size);
+      std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_cursor + kHeaderSize);
+      char* object = m_cursor + kHeaderSize + ((alignment - address % alignment) % alignment);
+      m_cursor = object + RoundUp(size);
+#if REF_COUNTER_ARENA_CHECKS
+      reinterpret_cast<BlockHeader*>(object - kHeaderSize)->arena = this;
+      m_live_objects.fetch_add(1, std::memory_order_relaxed);
+#endif
+      return object;
+    }
+
+    // Releases every object allocated since the last reset in one go. Only
+    // the most recent chunk is kept for reuse. Destructors have already run
+    // through OnFinalDestroy; nothing may still point into the arena.
+    void Reset() noexcept {
+#if REF_COUNTER_ARENA_CHECKS
+      assert(m_live_objects.load(std::memory_order_acquire) == 0 && "RefCounterPtr still points into a RefCounterArena being reset");
+#endif
+      if (m_chunks == nullptr)
+        return;
+      ReleaseChunks(m_chunks);
+      m_cursor = reinterpret_cast<char*>(m_chunks) + RoundUp(sizeof(Chunk));
+#if REF_COUNTER_ARENA_CHECKS
+      std::memset(m_cursor, 0xdd, m_end - m_cursor);
+#endif
+    }
+
+#if REF_COUNTER_ARENA_CHECKS
+    std::size_t LiveObjects() const noexcept {
+      return m_live_objects.load(std::memory_order_acquire);
+    }
+#endif
+
+    // Called after the destructor of an arena object has run.
+    static void Release(void* p) noexcept {
+#if REF_COUNTER_ARENA_CHECKS
+      BlockHeader* header = reinterpret_cast<BlockHeader*>(static_cast<char*>(p) - kHeaderSize);
+      header->arena->m_live_objects.fetch_sub(1, std::memory_order_release);
+#else
+      (void)p;
+#endif
+    }
+
+  private:
+    struct Chunk
+    {
+      Chunk* next;
+      std::size_t size;
+    };
+
+    struct BlockHeader
+    {
+      RefCounterArena* arena;
+    };
+
+    static constexpr std::size_t RoundUp(std::size_t size) noexcept {
+      return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+#if REF_COUNTER_ARENA_CHECKS
+    static constexpr std::size_t kHeaderSize = (sizeof(BlockHeader) + kAlignment - 1) / kAlignment * kAlignment;
+#else
+    static constexpr std::size_t kHeaderSize = 0;
+#endif
+
+    void AddChunk(std::size_t block_size) {
+      std::size_t size = RoundUp(sizeof(Chunk)) + block_size;
+      if (size < m_chunk_size)
+        size = m_chunk_size;
+      Chunk* chunk = static_cast<Chunk*>(::operator new(size));
+      chunk->next = m_chunks;
+      chunk->size = size;
+      m_chunks = chunk;
+      m_cursor = reinterpret_cast<char*>(chunk) + RoundUp(sizeof(Chunk));
+      m_end = reinterpret_cast<char*>(chunk) + size;
+    }
+
+    // Frees every chunk but keep, which becomes the only one left.
+    void ReleaseChunks(Chunk* keep) noexcept {
+      Chunk* chunk = m_chunks;
+      while (chunk != nullptr) {
+        Chunk* next = chunk->next;
+        if (chunk != keep)
+          ::operator delete(chunk);
+        chunk = next;
+      }
+      m_chunks = keep;
+      if (keep != nullptr) {
+        keep->next = nullptr;
+        m_end = reinterpret_cast<char*>(keep) + keep->size;
+      } else {
+        m_cursor = nullptr;
+        m_end = nullptr;
+      }
+    }
+
+    Chunk* m_chunks;
+    char* m_cursor;
+    char* m_end;
+    std::size_t m_chunk_size;
+#if REF_COUNTER_ARENA_CHECKS
+    std::atomic<std::size_t> m_live_objects;
+#endif
+  };
+
+  // Mixin for objects living in a RefCounterArena, created with
+  // MakeArenaRef. The final `delete this` only runs the destructor: the
+  // class operator delete leaves the memory to the arena.
+  template<class Base = RefCounter<>>
+  class ArenaRefCounter
+    : public Base
+  {
+  public:
+    static void* operator new(std::size_t size, RefCounterArena& arena) {
+      return arena.Allocate(size);
+    }
+
+    static void operator delete(void* p, RefCounterArena&) noexcept {
+      RefCounterArena::Release(p);
+    }
+
+    static void operator delete(void* p) noexcept {
+      RefCounterArena::Release(p);
+    }
+
+    static void* operator new(std::size_t size, std::align_val_t alignment, RefCounterArena& arena) {
+      return arena.Allocate(size, static_cast<std::size_t>(alignment));
+    }
+
+    static void operator delete(void* p, std::align_val_t, RefCounterArena&) noexcept {
+      RefCounterArena::Release(p);
+    }
+
+    static void operator delete(void* p, std::align_val_t) noexcept {
+      RefCounterArena::Release(p);
+    }
+
+    static void* operator new(std::size_t) = delete;
+
+    static void* operator new(std::size_t, std::align_val_t) = delete;
+
+  protected:
+    using Base::Base;
+
+    ArenaRefCounter() = default;
+
+    virtual ~ArenaRefCounter() = default;
+  };
+
+  template<class T, class... Args> RefCounterPtr<T> MakeArenaRef(RefCounterArena& arena, Args&&... args)
+  {
+    return RefCounterPtr<T>(new (arena) T(std::forward<Args>(args)...));
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_ARENA_H_
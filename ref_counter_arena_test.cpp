@@ -0,0 +1,112 @@
+#include "catch.hpp"
+#include "ref_counter_arena.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using ref_counter::ArenaRefCounter;
+using ref_counter::CacheAlignedCounter;
+using ref_counter::kCacheLineSize;
+using ref_counter::MakeArenaRef;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterArena;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter;
+
+class ArenaInterface
+  : virtual public RefCounter<ThreadSafeCounter>
+{
+public:
+  virtual std::string Name() = 0;
+
+protected:
+  virtual ~ArenaInterface() = default;
+};
+
+class ArenaObject
+  : public ArenaRefCounter<ArenaInterface>
+{
+public:
+  static int alive;
+
+  ArenaObject(std::string name) : name_(name)
+  {
+    ++alive;
+  }
+
+  virtual std::string Name() override {
+    return name_;
+  }
+
+protected:
+  virtual ~ArenaObject() {
+    --alive;
+  }
+
+private:
+  std::string name_;
+};
+
+int ArenaObject::alive = 0;
+
+class LargeArenaObject
+  : public ArenaRefCounter<RefCounter<ThreadUnsafeCounter>>
+{
+public:
+  char payload[4096] = {};
+
+protected:
+  virtual ~LargeArenaObject() = default;
+};
+
+class AlignedArenaObject
+  : public ArenaRefCounter<RefCounter<CacheAlignedCounter>>
+{
+protected:
+  virtual ~AlignedArenaObject() = default;
+};
+
+TEST_CASE("Test Arena Allocation") {
+  RefCounterArena arena(1024);
+  {
+    std::vector<RefCounterPtr<ArenaInterface>> objects;
+    for (int i = 0; i < 100; ++i)
+      objects.push_back(MakeArenaRef<ArenaObject>(arena, std::to_string(i)));
+    CHECK(ArenaObject::alive == 100);
+    CHECK(objects[42]->Name() == "42");
+    RefCounterPtr<LargeArenaObject> large = MakeArenaRef<LargeArenaObject>(arena);
+    CHECK(large->payload[0] == 0);
+#if REF_COUNTER_ARENA_CHECKS
+    CHECK(arena.LiveObjects() == 101);
+#endif
+  }
+  CHECK(ArenaObject::alive == 0);
+#if REF_COUNTER_ARENA_CHECKS
+  CHECK(arena.LiveObjects() == 0);
+#endif
+  arena.Reset();
+  RefCounterPtr<ArenaInterface> reused = MakeArenaRef<ArenaObject>(arena, "reused");
+  CHECK(reused->Name() == "reused");
+  CHECK(reused->UseCount() == 1);
+  reused.Reset();
+  arena.Reset();
+}
+
+TEST_CASE("Test Arena Over-Aligned Type") {
+  RefCounterArena arena(1024);
+  {
+    RefCounterPtr<ArenaInterface> small = MakeArenaRef<ArenaObject>(arena, "small");
+    RefCounterPtr<AlignedArenaObject> aligned = MakeArenaRef<AlignedArenaObject>(arena);
+    RefCounterPtr<AlignedArenaObject> other = MakeArenaRef<AlignedArenaObject>(arena);
+    CHECK(reinterpret_cast<std::uintptr_t>(aligned.Get()) % kCacheLineSize == 0);
+    CHECK(reinterpret_cast<std::uintptr_t>(other.Get()) % kCacheLineSize == 0);
+#if REF_COUNTER_ARENA_CHECKS
+    CHECK(arena.LiveObjects() == 3);
+#endif
+  }
+#if REF_COUNTER_ARENA_CHECKS
+  CHECK(arena.LiveObjects() == 0);
+#endif
+  arena.Reset();
+}
@@ -0,0 +1,162 @@
+#ifndef REF_COUNTER_ATOMIC_H_
+#define REF_COUNTER_ATOMIC_H_
+
+#include "ref_counter.h"
+#include <atomic>
+#include <thread>
+#include <utility>
+
+namespace ref_counter
+{
+  namespace detail
+  {
+    // One hazard pointer per thread. Slots are never freed: a thread that
+    // exits hands its slot back for reuse by the next thread.
+    struct alignas(kCacheLineSize) HazardSlot
+    {
+      std::atomic<void const*> pointer{ nullptr };
+      std::atomic<bool> in_use{ true };
+      HazardSlot* next = nullptr;
+    };
+
+    class HazardSlots
+    {
+    public:
+      static HazardSlot& Current() {
+        static thread_local Holder holder;
+        return *holder.slot;
+      }
+
+      static bool IsProtected(void const* p) noexcept {
+        for (HazardSlot* slot = Head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+          if (slot->pointer.load(std::memory_order_seq_cst) == p)
+            return true;
+        }
+        return false;
+      }
+
+      // Spins until no thread is between publishing p and taking its own
+      // reference to it.
+      static void WaitUntilUnprotected(void const* p) noexcept {
+        while (IsProtected(p))
+          std::this_thread::yield();
+      }
+
+    private:
+      struct Holder
+      {
+        HazardSlot* slot = Acquire();
+
+        ~Holder() {
+          slot->pointer.store(nullptr, std::memory_order_relaxed);
+          slot->in_use.store(false, std::memory_order_release);
+        }
+      };
+
+      static std::atomic<HazardSlot*>& Head() noexcept {
+        static std::atomic<HazardSlot*> head{ nullptr };
+        return head;
+      }
+
+      static HazardSlot* Acquire() {
+        for (HazardSlot* slot = Head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+          if (!slot->in_use.load(std::memory_order_relaxed) && !slot->in_use.exchange(true, std::memory_order_acquire))
+            return slot;
+        }
+        HazardSlot* slot = new HazardSlot;
+        slot->next = Head().load(std::memory_order_relaxed);
+        while (!Head().compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+        return slot;
+      }
+    };
+  } // namespace detail
+
+  // A RefCounterPtr slot that can be read and replaced concurrently. Load
+  // publishes the pointer it is about to increment in the calling thread's
+  // hazard slot; writers wait for that window to close before dropping the
+  // reference they replaced. Loads never block and take no lock; a writer
+  // pays a scan over one slot per thread.
+  template<class T>
+  class AtomicRefCounterPtr
+  {
+  public:
+    constexpr AtomicRefCounterPtr() noexcept : m_ptr(nullptr)
+    {
+    }
+
+    AtomicRefCounterPtr(RefCounterPtr<T> desired) noexcept : m_ptr(desired.Detach())
+    {
+    }
+
+    AtomicRefCounterPtr(AtomicRefCounterPtr const&) = delete;
+    AtomicRefCounterPtr& operator= (AtomicRefCounterPtr const&) = delete;
+
+    // No other thread may access the slot any more.
+    ~AtomicRefCounterPtr()
+    {
+      T* p = m_ptr.load(std::memory_order_relaxed);
+      if (p != 0) p->Decrement();
+    }
+
+    RefCounterPtr<T> Load() const
+    {
+      detail::HazardSlot& slot = detail::HazardSlots::Current();
+      T* p = m_ptr.load(std::memory_order_relaxed);
+      for (;;) {
+        slot.pointer.store(p, std::memory_order_seq_cst);
+        T* current = m_ptr.load(std::memory_order_seq_cst);
+        if (current == p)
+          break;
+        p = current;
+      }
+      RefCounterPtr<T> result(p);
+      slot.pointer.store(nullptr, std::memory_order_release);
+      return result;
+    }
+
+    void Store(RefCounterPtr<T> desired)
+    {
+      Exchange(std::move(desired));
+    }
+
+    RefCounterPtr<T> Exchange(RefCounterPtr<T> desired)
+    {
+      T* previous = m_ptr.exchange(desired.Detach(), std::memory_order_seq_cst);
+      return Retire(previous);
+    }
+
+    // Replaces the value with desired if it still is expected. Otherwise
+    // expected is updated to the current value.
+    bool CompareExchange(RefCounterPtr<T>& expected, RefCounterPtr<T> desired)
+    {
+      T* previous = expected.Get();
+      if (m_ptr.compare_exchange_strong(previous, desired.Get(), std::memory_order_seq_cst)) {
+        (void)desired.Detach();
+        Retire(previous);
+        return true;
+      }
+      expected = Load();
+      return false;
+    }
+
+    bool IsLockFree() const noexcept
+    {
+      return m_ptr.is_lock_free();
+    }
+
+  private:
+    // Takes over the reference the slot held on p once no reader can still
+    // be about to increment it.
+    static RefCounterPtr<T> Retire(T* p) noexcept
+    {
+      if (p != 0)
+        detail::HazardSlots::WaitUntilUnprotected(p);
+      return RefCounterPtr<T>(p, false);
+    }
+
+    std::atomic<T*> m_ptr;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_ATOMIC_H_
@@ -0,0 +1,98 @@
+#include "catch.hpp"
+#include "ref_counter_atomic.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::AtomicRefCounterPtr;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadSafeCounter;
+
+class SharedConfig
+  : public RefCounter<ThreadSafeCounter>
+{
+public:
+  static std::atomic<int> alive;
+
+  SharedConfig(int v) : version(v)
+  {
+    ++alive;
+  }
+
+  int const version;
+
+protected:
+  virtual ~SharedConfig() {
+    --alive;
+  }
+};
+
+std::atomic<int> SharedConfig::alive(0);
+
+TEST_CASE("Test Atomic Pointer") {
+  {
+    AtomicRefCounterPtr<SharedConfig> slot;
+    CHECK(!slot.Load());
+    slot.Store(new SharedConfig(1));
+    RefCounterPtr<SharedConfig> first = slot.Load();
+    CHECK(first->version == 1);
+    CHECK(first->UseCount() == 2);
+
+    RefCounterPtr<SharedConfig> previous = slot.Exchange(new SharedConfig(2));
+    CHECK(previous == first);
+    CHECK(first->UseCount() == 2);
+    previous.Reset();
+    CHECK(SharedConfig::alive == 2);
+
+    RefCounterPtr<SharedConfig> expected = first;
+    CHECK(!slot.CompareExchange(expected, new SharedConfig(3)));
+    CHECK(expected->version == 2);
+    CHECK(SharedConfig::alive == 2);
+    CHECK(slot.CompareExchange(expected, new SharedConfig(4)));
+    CHECK(slot.Load()->version == 4);
+    CHECK(expected->UseCount() == 1);
+    first.Reset();
+    expected.Reset();
+    CHECK(SharedConfig::alive == 1);
+  }
+  CHECK(SharedConfig::alive == 0);
+}
+
+TEST_CASE("Test Atomic Pointer Race") {
+  {
+    AtomicRefCounterPtr<SharedConfig> slot(new SharedConfig(0));
+    std::atomic<bool> stop(false);
+    std::atomic<int> regressions(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+      readers.emplace_back([&] {
+        int last = 0;
+        while (!stop) {
+          RefCounterPtr<SharedConfig> config = slot.Load();
+          if (config->version < last)
+            ++regressions;
+          last = config->version;
+        }
+      });
+    }
+    std::thread writer([&] {
+      for (int version = 1; version <= 20000; ++version) {
+        if (version % 2 == 0) {
+          slot.Store(new SharedConfig(version));
+        } else {
+          RefCounterPtr<SharedConfig> expected = slot.Load();
+          while (!slot.CompareExchange(expected, new SharedConfig(version))) {}
+        }
+      }
+      stop = true;
+    });
+    writer.join();
+    for (std::thread& reader : readers)
+      reader.join();
+    CHECK(regressions == 0);
+    CHECK(slot.Load()->version == 20000);
+    CHECK(SharedConfig::alive == 1);
+  }
+  CHECK(SharedConfig::alive == 0);
+}
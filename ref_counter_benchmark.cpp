@@ -0,0 +1,1132 @@
+#include "catch.hpp"
+#include "ref_counter.h"
+#include "ref_counter_arena.h"
+#include "ref_counter_atomic.h"
+#include "ref_counter_cache.h"
+#include "ref_counter_channel.h"
+#include "ref_counter_cow.h"
+#include "ref_counter_interface.h"
+#include "ref_counter_parallel.h"
+#include "ref_counter_pool.h"
+#include "ref_counter_queue.h"
+#include "ref_counter_reclaim.h"
+#include "ref_counter_sharded.h"
+#include "ref_counter_snapshot.h"
+#include "ref_counter_stats.h"
+#include "ref_counter_string.h"
+#include "ref_counter_vector.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using ref_counter::ArenaRefCounter;
+using ref_counter::AtomicRefCounterPtr;
+using ref_counter::BackgroundReclaimer;
+using ref_counter::BiasedCounter;
+using ref_counter::CacheAlignedCounter;
+using ref_counter::CowPtr;
+using ref_counter::DeferredReleaseScope;
+using ref_counter::ImmortalCounter;
+using ref_counter::InstrumentedCounter;
+using ref_counter::kImmortal;
+using ref_counter::dynamic_pointer_cast;
+using ref_counter::MakeArenaRef;
+using ref_counter::MakeCow;
+using ref_counter::MakeRef;
+using ref_counter::MakeRefFor;
+using ref_counter::PackedThreadSafeCounter;
+using ref_counter::ParallelRelease;
+using ref_counter::RefCounterArena;
+using ref_counter::PooledRefCounter;
+using ref_counter::RefCounted;
+using ref_counter::RefCountedImpl;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterBase;
+using ref_counter::RefCounterCache;
+using ref_counter::RefCounterChannel;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterPtrFor;
+using ref_counter::RefCounterPtrVector;
+using ref_counter::RefCounterQueue;
+using ref_counter::RefCounterQueueHook;
+using ref_counter::RefCounterRef;
+using ref_counter::RefString;
+using ref_counter::ShardedCounter;
+using ref_counter::Snapshot;
+using ref_counter::static_pointer_cast;
+using ref_counter::ThreadExecutor;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter;
+
+// Benchmarks are hidden from the default run, select them with
+// `ref_counter "[benchmark]"`. Add `-r xml` for machine-readable results
+// to track across builds.
+
+namespace
+{
+  // The sequentially consistent policy ThreadSafeCounter used to be, kept as
+  // the baseline for the memory-order comparison.
+  struct SeqCstCounter
+  {
+    typedef std::atomic<unsigned int> Type;
+
+    static unsigned int Load(Type const& counter) noexcept
+    {
+      return counter.load();
+    }
+
+    static void Increment(Type& counter) noexcept
+    {
+      ++counter;
+    }
+
+    static unsigned int Decrement(Type& counter) noexcept
+    {
+      return --counter;
+    }
+  };
+
+  template<typename CounterPolicy>
+  class BenchmarkObject
+    : public RefCounter<CounterPolicy>
+  {
+  public:
+    int value = 0;
+
+  protected:
+    virtual ~BenchmarkObject() = default;
+  };
+
+  template<typename CounterPolicy>
+  class PooledBenchmarkObject
+    : public PooledRefCounter<RefCounter<CounterPolicy>>
+  {
+  public:
+    int value = 0;
+
+  protected:
+    virtual ~PooledBenchmarkObject() = default;
+  };
+
+  template<typename CounterPolicy>
+  class ArenaBenchmarkObject
+    : public ArenaRefCounter<RefCounter<CounterPolicy>>
+  {
+  public:
+    int value = 0;
+
+  protected:
+    virtual ~ArenaBenchmarkObject() = default;
+  };
+
+  class GraphNode
+    : public RefCounter<ThreadSafeCounter>
+  {
+  public:
+    std::vector<RefCounterPtr<GraphNode>> children;
+
+  protected:
+    virtual ~GraphNode() = default;
+  };
+
+  RefCounterPtr<GraphNode> MakeGraph(int fan_out, int depth) {
+    RefCounterPtr<GraphNode> node(new GraphNode);
+    if (depth > 0) {
+      for (int i = 0; i < fan_out; ++i)
+        node->children.push_back(MakeGraph(fan_out, depth - 1));
+    }
+    return node;
+  }
+
+  template<typename CounterPolicy>
+  class CrtpBenchmarkObject
+    : public RefCounterBase<CrtpBenchmarkObject<CounterPolicy>, CounterPolicy>
+  {
+  public:
+    int value = 0;
+  };
+
+  template<typename CounterPolicy>
+  class DerivedBenchmarkObject
+    : public BenchmarkObject<CounterPolicy>
+  {
+  protected:
+    virtual ~DerivedBenchmarkObject() = default;
+  };
+
+  constexpr int kOperationsPerThread = 100000;
+  constexpr int kContainerSize = 1000;
+
+  // 1, 2, 4, ... up to the hardware concurrency, and at least 2.
+  std::vector<unsigned int> BenchmarkThreadCounts() {
+    unsigned int max_threads = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> counts;
+    for (unsigned int count = 1; count < max_threads; count *= 2)
+      counts.push_back(count);
+    counts.push_back(max_threads);
+    return counts;
+  }
+
+  template<typename Function>
+  void RunOnThreads(unsigned int thread_count, Function function) {
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    for (unsigned int i = 0; i < thread_count; ++i)
+      threads.emplace_back(function);
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  template<typename CounterPolicy>
+  int CopyAndDestroy(RefCounterPtr<BenchmarkObject<CounterPolicy>> const& source) {
+    int sum = 0;
+    for (int i = 0; i < kOperationsPerThread; ++i) {
+      RefCounterPtr<BenchmarkObject<CounterPolicy>> copy = source;
+      sum += copy->value;
+    }
+    return sum;
+  }
+
+  // One thread copies references while another reads the object's fields;
+  // with a packed counter both hit the same cache line.
+  template<typename CounterPolicy>
+  int CopyWhileReading(RefCounterPtr<BenchmarkObject<CounterPolicy>> const& source) {
+    std::atomic<int> sink(0);
+    std::thread reader([&] {
+      int sum = 0;
+      for (int i = 0; i < kOperationsPerThread; ++i)
+        sum += *static_cast<int volatile*>(&source->value);
+      sink += sum;
+    });
+    sink += CopyAndDestroy(source);
+    reader.join();
+    return sink.load();
+  }
+
+  template<typename CounterPolicy>
+  int CreateAndRead(int count) {
+    std::vector<RefCounterPtr<BenchmarkObject<CounterPolicy>>> objects;
+    objects.reserve(count);
+    for (int i = 0; i < count; ++i)
+      objects.push_back(RefCounterPtr<BenchmarkObject<CounterPolicy>>(new BenchmarkObject<CounterPolicy>));
+    int sum = 0;
+    for (auto const& object : objects)
+      sum += object->value;
+    return sum;
+  }
+
+  template<typename CounterPolicy>
+  void DisjointCopyAndDestroy(unsigned int thread_count) {
+    std::atomic<int> sink(0);
+    RunOnThreads(thread_count, [&] {
+      RefCounterPtr<BenchmarkObject<CounterPolicy>> own(new BenchmarkObject<CounterPolicy>);
+      sink += CopyAndDestroy(own);
+    });
+  }
+
+  // A call chain passing the object down depth levels. The recursion keeps
+  // the compiler from collapsing the levels into one.
+  template<class Param>
+  int CallChain(Param object, int depth) {
+    if (depth == 0)
+      return object->value;
+    return CallChain<Param>(object, depth - 1) + 1;
+  }
+
+  template<typename CounterPolicy>
+  void ContendedCopyAndDestroy(RefCounterPtr<BenchmarkObject<CounterPolicy>> const& source, unsigned int thread_count) {
+    std::atomic<int> sink(0);
+    RunOnThreads(thread_count, [&] {
+      sink += CopyAndDestroy(source);
+    });
+  }
+} // namespace
+
+TEST_CASE("Benchmark Counter Memory Order", "[.][benchmark]") {
+  RefCounterPtr<BenchmarkObject<SeqCstCounter>> seq_cst(new BenchmarkObject<SeqCstCounter>);
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> acq_rel(new BenchmarkObject<ThreadSafeCounter>);
+  unsigned int thread_count = std::thread::hardware_concurrency();
+  if (thread_count < 2)
+    thread_count = 2;
+
+  BENCHMARK("seq_cst copy/destroy, 1 thread") {
+    return CopyAndDestroy(seq_cst);
+  };
+
+  BENCHMARK("relaxed/release copy/destroy, 1 thread") {
+    return CopyAndDestroy(acq_rel);
+  };
+
+  BENCHMARK("seq_cst copy/destroy, all threads on one object") {
+    ContendedCopyAndDestroy(seq_cst, thread_count);
+  };
+
+  BENCHMARK("relaxed/release copy/destroy, all threads on one object") {
+    ContendedCopyAndDestroy(acq_rel, thread_count);
+  };
+
+  BENCHMARK("seq_cst create/destroy") {
+    return RefCounterPtr<BenchmarkObject<SeqCstCounter>>(new BenchmarkObject<SeqCstCounter>);
+  };
+
+  BENCHMARK("relaxed/release create/destroy") {
+    return RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>(new BenchmarkObject<ThreadSafeCounter>);
+  };
+}
+
+TEST_CASE("Benchmark Pooled Allocation", "[.][benchmark]") {
+  BENCHMARK("global allocator create/destroy") {
+    return MakeRef<BenchmarkObject<ThreadSafeCounter>>();
+  };
+
+  BENCHMARK("pooled create/destroy") {
+    return MakeRef<PooledBenchmarkObject<ThreadSafeCounter>>();
+  };
+}
+
+TEST_CASE("Benchmark Arena Request", "[.][benchmark]") {
+  constexpr int kObjectsPerRequest = 1000;
+  std::vector<RefCounterPtr<RefCounter<ThreadSafeCounter>>> objects;
+  objects.reserve(kObjectsPerRequest);
+  RefCounterArena arena;
+
+  BENCHMARK("global allocator request of 1000 objects") {
+    for (int i = 0; i < kObjectsPerRequest; ++i)
+      objects.push_back(MakeRef<BenchmarkObject<ThreadSafeCounter>>());
+    objects.clear();
+  };
+
+  BENCHMARK("arena request of 1000 objects") {
+    for (int i = 0; i < kObjectsPerRequest; ++i)
+      objects.push_back(MakeArenaRef<ArenaBenchmarkObject<ThreadSafeCounter>>(arena));
+    objects.clear();
+    arena.Reset();
+  };
+}
+
+TEST_CASE("Benchmark Biased Counter", "[.][benchmark]") {
+  RefCounterPtr<BenchmarkObject<ThreadUnsafeCounter>> unsafe(new BenchmarkObject<ThreadUnsafeCounter>);
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> safe(new BenchmarkObject<ThreadSafeCounter>);
+  RefCounterPtr<BenchmarkObject<BiasedCounter>> biased(new BenchmarkObject<BiasedCounter>);
+
+  BENCHMARK("ThreadUnsafeCounter copy/destroy on owner") {
+    return CopyAndDestroy(unsafe);
+  };
+
+  BENCHMARK("ThreadSafeCounter copy/destroy on owner") {
+    return CopyAndDestroy(safe);
+  };
+
+  BENCHMARK("BiasedCounter copy/destroy on owner") {
+    return CopyAndDestroy(biased);
+  };
+
+  BENCHMARK("ThreadSafeCounter copy/destroy on another thread") {
+    int sum = 0;
+    std::thread([&] { sum = CopyAndDestroy(safe); }).join();
+    return sum;
+  };
+
+  BENCHMARK("BiasedCounter copy/destroy on another thread") {
+    int sum = 0;
+    std::thread([&] { sum = CopyAndDestroy(biased); }).join();
+    return sum;
+  };
+}
+
+TEST_CASE("Benchmark Deferred Release", "[.][benchmark]") {
+  BackgroundReclaimer reclaimer;
+
+  // Both include building the graph; the difference is the release cost
+  // paid by the thread dropping the last reference.
+  BENCHMARK("build and inline release of a 4^4 node graph") {
+    MakeGraph(4, 4).Reset();
+  };
+
+  BENCHMARK("build and deferred release of a 4^4 node graph") {
+    RefCounterPtr<GraphNode> graph = MakeGraph(4, 4);
+    DeferredReleaseScope scope(reclaimer);
+    graph.Reset();
+  };
+
+  reclaimer.Flush();
+}
+
+TEST_CASE("Benchmark Atomic Pointer", "[.][benchmark]") {
+  unsigned int thread_count = std::thread::hardware_concurrency();
+  std::mutex mutex;
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> locked(new BenchmarkObject<ThreadSafeCounter>);
+  AtomicRefCounterPtr<BenchmarkObject<ThreadSafeCounter>> atomic(new BenchmarkObject<ThreadSafeCounter>);
+
+  BENCHMARK("mutex guarded load, all threads") {
+    std::atomic<int> sink(0);
+    RunOnThreads(thread_count, [&] {
+      int sum = 0;
+      for (int i = 0; i < kOperationsPerThread; ++i) {
+        RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> copy;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          copy = locked;
+        }
+        sum += copy->value;
+      }
+      sink += sum;
+    });
+    return sink.load();
+  };
+
+  BENCHMARK("AtomicRefCounterPtr load, all threads") {
+    std::atomic<int> sink(0);
+    RunOnThreads(thread_count, [&] {
+      int sum = 0;
+      for (int i = 0; i < kOperationsPerThread; ++i)
+        sum += atomic.Load()->value;
+      sink += sum;
+    });
+    return sink.load();
+  };
+
+  BENCHMARK("AtomicRefCounterPtr store") {
+    atomic.Store(new BenchmarkObject<ThreadSafeCounter>);
+  };
+}
+
+TEMPLATE_TEST_CASE("Benchmark RefCounterPtr Operations", "[.][benchmark][operations]", ThreadUnsafeCounter, ThreadSafeCounter) {
+  typedef BenchmarkObject<TestType> Object;
+  typedef DerivedBenchmarkObject<TestType> Derived;
+  RefCounterPtr<Object> source(new Derived);
+
+  BENCHMARK("copy/destroy") {
+    RefCounterPtr<Object> copy = source;
+    return copy.Get();
+  };
+
+  BENCHMARK("move there and back") {
+    RefCounterPtr<Object> moved = std::move(source);
+    source = std::move(moved);
+    return source.Get();
+  };
+
+  BENCHMARK("copy then Reset") {
+    RefCounterPtr<Object> copy = source;
+    copy.Reset();
+    return copy.Get();
+  };
+
+  BENCHMARK("copy then Detach and Decrement") {
+    RefCounterPtr<Object> copy = source;
+    Object* raw = copy.Detach();
+    raw->Decrement();
+    return raw;
+  };
+
+  BENCHMARK("static_pointer_cast copy") {
+    return static_pointer_cast<Derived>(source).Get();
+  };
+
+  BENCHMARK("dynamic_pointer_cast copy") {
+    return dynamic_pointer_cast<Derived>(source).Get();
+  };
+
+  BENCHMARK("static_pointer_cast move") {
+    RefCounterPtr<Derived> derived = static_pointer_cast<Derived>(std::move(source));
+    source = std::move(derived);
+    return source.Get();
+  };
+
+  BENCHMARK("vector growth to 1000 copies") {
+    std::vector<RefCounterPtr<Object>> objects;
+    for (int i = 0; i < kContainerSize; ++i)
+      objects.push_back(source);
+    return objects.size();
+  };
+
+  std::vector<RefCounterPtr<Object>> keys;
+  for (int i = 0; i < kContainerSize; ++i)
+    keys.push_back(RefCounterPtr<Object>(new Object));
+
+  BENCHMARK("unordered_map insert 1000") {
+    std::unordered_map<RefCounterPtr<Object>, int> map;
+    for (int i = 0; i < kContainerSize; ++i)
+      map.emplace(keys[i], i);
+    return map.size();
+  };
+
+  std::unordered_map<RefCounterPtr<Object>, int> map;
+  for (int i = 0; i < kContainerSize; ++i)
+    map.emplace(keys[i], i);
+
+  BENCHMARK("unordered_map find 1000") {
+    int sum = 0;
+    for (int i = 0; i < kContainerSize; ++i)
+      sum += map.find(keys[i])->second;
+    return sum;
+  };
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("copy/destroy on disjoint objects, " + threads) {
+      DisjointCopyAndDestroy<TestType>(thread_count);
+    };
+
+    // Sharing one object between threads needs an atomic count.
+    if (std::is_same<TestType, ThreadSafeCounter>::value) {
+      RefCounterPtr<BenchmarkObject<TestType>> shared(new BenchmarkObject<TestType>);
+      BENCHMARK("copy/destroy on one object, " + threads) {
+        ContendedCopyAndDestroy(shared, thread_count);
+      };
+    }
+  }
+}
+
+TEST_CASE("Benchmark Counter Cache Line Isolation", "[.][benchmark]") {
+  RefCounterPtr<BenchmarkObject<PackedThreadSafeCounter>> packed(new BenchmarkObject<PackedThreadSafeCounter>);
+  RefCounterPtr<BenchmarkObject<CacheAlignedCounter>> aligned(new BenchmarkObject<CacheAlignedCounter>);
+
+  BENCHMARK("packed counter, copy while another thread reads fields") {
+    return CopyWhileReading(packed);
+  };
+
+  BENCHMARK("cache aligned counter, copy while another thread reads fields") {
+    return CopyWhileReading(aligned);
+  };
+
+  BENCHMARK("packed counter, create and read 1000 objects") {
+    return CreateAndRead<PackedThreadSafeCounter>(kContainerSize);
+  };
+
+  BENCHMARK("cache aligned counter, create and read 1000 objects") {
+    return CreateAndRead<CacheAlignedCounter>(kContainerSize);
+  };
+}
+
+TEMPLATE_TEST_CASE("Benchmark Non-Virtual RefCounterBase", "[.][benchmark]", ThreadUnsafeCounter, ThreadSafeCounter) {
+  RefCounterPtr<BenchmarkObject<TestType>> virtual_object(new BenchmarkObject<TestType>);
+  RefCounterPtr<CrtpBenchmarkObject<TestType>> crtp_object(new CrtpBenchmarkObject<TestType>);
+
+  BENCHMARK("RefCounter copy/destroy") {
+    RefCounterPtr<BenchmarkObject<TestType>> copy = virtual_object;
+    return copy.Get();
+  };
+
+  BENCHMARK("RefCounterBase copy/destroy") {
+    RefCounterPtr<CrtpBenchmarkObject<TestType>> copy = crtp_object;
+    return copy.Get();
+  };
+
+  BENCHMARK("RefCounter create/destroy") {
+    return RefCounterPtr<BenchmarkObject<TestType>>(new BenchmarkObject<TestType>).Get();
+  };
+
+  BENCHMARK("RefCounterBase create/destroy") {
+    return RefCounterPtr<CrtpBenchmarkObject<TestType>>(new CrtpBenchmarkObject<TestType>).Get();
+  };
+}
+
+TEST_CASE("Benchmark MakeRefFor", "[.][benchmark]") {
+  struct Payload
+  {
+    int value = 0;
+  };
+
+  std::shared_ptr<Payload> shared = std::make_shared<Payload>();
+  RefCounterPtrFor<Payload> intrusive = MakeRefFor<Payload>();
+  RefCounterPtrFor<Payload, ThreadUnsafeCounter> unsafe = MakeRefFor<Payload, ThreadUnsafeCounter>();
+
+  // libstdc++ skips the atomic operations while the process is single
+  // threaded, compare with both policies.
+  BENCHMARK("std::make_shared create/destroy") {
+    return std::make_shared<Payload>().get();
+  };
+
+  BENCHMARK("MakeRefFor create/destroy") {
+    return MakeRefFor<Payload>().Get();
+  };
+
+  BENCHMARK("MakeRefFor ThreadUnsafeCounter create/destroy") {
+    return MakeRefFor<Payload, ThreadUnsafeCounter>().Get();
+  };
+
+  BENCHMARK("std::shared_ptr copy/destroy") {
+    std::shared_ptr<Payload> copy = shared;
+    return copy.get();
+  };
+
+  BENCHMARK("RefCounterPtrFor copy/destroy") {
+    RefCounterPtrFor<Payload> copy = intrusive;
+    return copy.Get();
+  };
+
+  BENCHMARK("RefCounterPtrFor ThreadUnsafeCounter copy/destroy") {
+    RefCounterPtrFor<Payload, ThreadUnsafeCounter> copy = unsafe;
+    return copy.Get();
+  };
+}
+
+TEST_CASE("Benchmark Bulk Reference Counting", "[.][benchmark]") {
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> source(new BenchmarkObject<ThreadSafeCounter>);
+
+  BENCHMARK("std::vector fill and clear 1000 copies") {
+    std::vector<RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>> objects(kContainerSize, source);
+    return objects.size();
+  };
+
+  BENCHMARK("RefCounterPtrVector fill and clear 1000 copies") {
+    RefCounterPtrVector<BenchmarkObject<ThreadSafeCounter>> objects(kContainerSize, source);
+    return objects.Size();
+  };
+
+  std::vector<RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>> plain(kContainerSize, source);
+  RefCounterPtrVector<BenchmarkObject<ThreadSafeCounter>> bulk(kContainerSize, source);
+
+  BENCHMARK("std::vector copy of 1000 copies") {
+    std::vector<RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>> copy = plain;
+    return copy.size();
+  };
+
+  BENCHMARK("RefCounterPtrVector copy of 1000 copies") {
+    RefCounterPtrVector<BenchmarkObject<ThreadSafeCounter>> copy = bulk;
+    return copy.Size();
+  };
+}
+
+TEST_CASE("Benchmark Sharded Counter Scaling", "[.][benchmark]") {
+  constexpr int kOperations = 10000;
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> single(new BenchmarkObject<ThreadSafeCounter>);
+  RefCounterPtr<BenchmarkObject<ShardedCounter>> sharded(new BenchmarkObject<ShardedCounter>);
+
+  for (unsigned int thread_count = 1; thread_count <= 128; thread_count *= 2) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("counted copy/destroy, " + threads) {
+      RunOnThreads(thread_count, [&] {
+        for (int i = 0; i < kOperations; ++i)
+          RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> copy = single;
+      });
+    };
+
+    BENCHMARK("ShardedCounter copy/destroy, " + threads) {
+      RunOnThreads(thread_count, [&] {
+        for (int i = 0; i < kOperations; ++i)
+          RefCounterPtr<BenchmarkObject<ShardedCounter>> copy = sharded;
+      });
+    };
+  }
+
+  sharded->Kill();
+}
+
+TEST_CASE("Benchmark Instrumented Counter", "[.][benchmark]") {
+  typedef InstrumentedCounter<ThreadSafeCounter, BenchmarkObject<ThreadSafeCounter>> Instrumented;
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> plain(new BenchmarkObject<ThreadSafeCounter>);
+  RefCounterPtr<BenchmarkObject<Instrumented>> instrumented(new BenchmarkObject<Instrumented>);
+
+  BENCHMARK("ThreadSafeCounter copy/destroy") {
+    RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> copy = plain;
+    return copy.Get();
+  };
+
+  BENCHMARK("InstrumentedCounter<ThreadSafeCounter> copy/destroy") {
+    RefCounterPtr<BenchmarkObject<Instrumented>> copy = instrumented;
+    return copy.Get();
+  };
+}
+
+namespace
+{
+  class QueuedObject
+    : public RefCounter<>
+    , public RefCounterQueueHook
+  {
+  protected:
+    virtual ~QueuedObject() = default;
+  };
+
+  class LockedQueue
+  {
+  public:
+    void Push(RefCounterPtr<QueuedObject> const& p) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push(p);
+    }
+
+    RefCounterPtr<QueuedObject> Pop() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_queue.empty())
+        return RefCounterPtr<QueuedObject>();
+      RefCounterPtr<QueuedObject> p = m_queue.front();
+      m_queue.pop();
+      return p;
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::queue<RefCounterPtr<QueuedObject>> m_queue;
+  };
+
+  template<typename Queue>
+  void PassThroughQueue(Queue& queue, std::vector<RefCounterPtr<QueuedObject>>& objects) {
+    std::vector<RefCounterPtr<QueuedObject>> received;
+    received.reserve(objects.size());
+    std::thread producer([&] {
+      for (RefCounterPtr<QueuedObject>& object : objects)
+        queue.Push(std::move(object));
+    });
+    while (received.size() < objects.size()) {
+      if (RefCounterPtr<QueuedObject> object = queue.Pop())
+        received.push_back(std::move(object));
+      else
+        std::this_thread::yield();
+    }
+    producer.join();
+    objects.swap(received);
+  }
+}
+
+namespace
+{
+  // RefCounterChannel behind the Push/Pop interface of PassThroughQueue.
+  class ChannelQueue
+  {
+  public:
+    void Push(RefCounterPtr<QueuedObject>&& p) {
+      m_channel.Send(std::move(p));
+    }
+
+    RefCounterPtr<QueuedObject> Pop() {
+      return m_channel.TryReceive().Adopt();
+    }
+
+  private:
+    RefCounterChannel<QueuedObject, 256> m_channel;
+  };
+}
+
+TEST_CASE("Benchmark RefCounterQueue", "[.][benchmark]") {
+  std::vector<RefCounterPtr<QueuedObject>> objects;
+  for (int i = 0; i < kContainerSize; ++i)
+    objects.push_back(RefCounterPtr<QueuedObject>(new QueuedObject));
+  LockedQueue locked;
+  RefCounterQueue<QueuedObject> lock_free;
+
+  BENCHMARK("std::queue and mutex push/pop 1000") {
+    for (RefCounterPtr<QueuedObject> const& object : objects)
+      locked.Push(object);
+    for (std::size_t i = 0; i < objects.size(); ++i)
+      locked.Pop();
+  };
+
+  BENCHMARK("RefCounterQueue push/pop 1000") {
+    for (RefCounterPtr<QueuedObject>& object : objects)
+      lock_free.Push(std::move(object));
+    for (RefCounterPtr<QueuedObject>& object : objects)
+      object = lock_free.Pop();
+  };
+
+  BENCHMARK("std::queue and mutex producer to consumer 1000") {
+    PassThroughQueue(locked, objects);
+  };
+
+  BENCHMARK("RefCounterQueue producer to consumer 1000") {
+    PassThroughQueue(lock_free, objects);
+  };
+
+  ChannelQueue channel;
+  BENCHMARK("RefCounterChannel producer to consumer 1000") {
+    PassThroughQueue(channel, objects);
+  };
+}
+
+namespace
+{
+  class MessageBuffer
+    : public RefCounter<>
+  {
+  public:
+    std::vector<char> bytes = std::vector<char>(4096);
+  };
+}
+
+TEST_CASE("Benchmark CowPtr", "[.][benchmark]") {
+  RefCounterPtr<MessageBuffer> buffer(new MessageBuffer);
+  CowPtr<MessageBuffer> cow = MakeCow<MessageBuffer>();
+
+  BENCHMARK("deep copy before every write of a 4 KiB buffer") {
+    buffer = RefCounterPtr<MessageBuffer>(new MessageBuffer(*buffer));
+    return ++buffer->bytes[0];
+  };
+
+  BENCHMARK("CowPtr write to an unshared 4 KiB buffer") {
+    return ++cow.Mutate().bytes[0];
+  };
+
+  BENCHMARK("CowPtr write to a shared 4 KiB buffer") {
+    CowPtr<MessageBuffer> copy = cow;
+    return ++copy.Mutate().bytes[0];
+  };
+}
+
+namespace
+{
+  class SharedString
+    : public RefCounter<>
+  {
+  public:
+    explicit SharedString(std::string text)
+      : text(std::move(text))
+    {
+    }
+
+    std::string text;
+  };
+
+  struct SharedStringHash
+  {
+    std::size_t operator()(RefCounterPtr<SharedString> const& s) const {
+      return std::hash<std::string>()(s->text);
+    }
+  };
+
+  struct SharedStringEqual
+  {
+    bool operator()(RefCounterPtr<SharedString> const& a, RefCounterPtr<SharedString> const& b) const {
+      return a->text == b->text;
+    }
+  };
+}
+
+TEST_CASE("Benchmark RefString", "[.][benchmark]") {
+  std::vector<std::string> texts;
+  for (int i = 0; i < kContainerSize; ++i)
+    texts.push_back("benchmark/key/number/" + std::to_string(i));
+
+  std::vector<RefCounterPtr<SharedString>> wrapped;
+  std::vector<RefString> strings;
+  std::unordered_map<RefCounterPtr<SharedString>, int, SharedStringHash, SharedStringEqual> wrapped_map;
+  std::unordered_map<RefString, int> string_map;
+  for (std::string const& text : texts) {
+    wrapped.push_back(RefCounterPtr<SharedString>(new SharedString(text)));
+    strings.push_back(RefString(text));
+    wrapped_map.emplace(wrapped.back(), 0);
+    string_map.emplace(strings.back(), 0);
+  }
+
+  BENCHMARK("RefCounterPtr<wrapper of std::string> create 1000") {
+    std::vector<RefCounterPtr<SharedString>> created;
+    created.reserve(texts.size());
+    for (std::string const& text : texts)
+      created.push_back(RefCounterPtr<SharedString>(new SharedString(text)));
+    return created.size();
+  };
+
+  BENCHMARK("RefString create 1000") {
+    std::vector<RefString> created;
+    created.reserve(texts.size());
+    for (std::string const& text : texts)
+      created.push_back(RefString(text));
+    return created.size();
+  };
+
+  BENCHMARK("RefCounterPtr<wrapper of std::string> unordered_map find 1000") {
+    int found = 0;
+    for (RefCounterPtr<SharedString> const& key : wrapped)
+      found += static_cast<int>(wrapped_map.count(key));
+    return found;
+  };
+
+  BENCHMARK("RefString unordered_map find 1000") {
+    int found = 0;
+    for (RefString const& key : strings)
+      found += static_cast<int>(string_map.count(key));
+    return found;
+  };
+}
+
+namespace
+{
+  // The virtual-base layout used by the interfaces in ref_counter_test.cpp.
+  class VirtualBaseFirst
+    : virtual public RefCounter<ThreadSafeCounter>
+  {
+  public:
+    virtual int First() = 0;
+  };
+
+  class VirtualBaseSecond
+    : virtual public RefCounter<ThreadSafeCounter>
+  {
+  public:
+    virtual int Second() = 0;
+  };
+
+  class VirtualBaseObject final
+    : public VirtualBaseFirst
+    , public VirtualBaseSecond
+  {
+  public:
+    virtual int First() override { return 1; }
+    virtual int Second() override { return 2; }
+  };
+
+  class InterfaceFirst
+    : public RefCounted
+  {
+  public:
+    virtual int First() = 0;
+  };
+
+  class InterfaceSecond
+    : public RefCounted
+  {
+  public:
+    virtual int Second() = 0;
+  };
+
+  class InterfaceObject final
+    : public RefCountedImpl<ThreadSafeCounter, InterfaceFirst, InterfaceSecond>
+  {
+  public:
+    virtual int First() override { return 1; }
+    virtual int Second() override { return 2; }
+  };
+}
+
+TEST_CASE("Benchmark RefCounted Interfaces", "[.][benchmark]") {
+  RefCounterPtr<VirtualBaseObject> virtual_object(new VirtualBaseObject);
+  RefCounterPtr<VirtualBaseSecond> virtual_second(virtual_object);
+  RefCounterPtr<InterfaceObject> interface_object(new InterfaceObject);
+  RefCounterPtr<InterfaceSecond> interface_second(interface_object);
+
+  BENCHMARK("virtual RefCounter base, copy/destroy through second interface") {
+    RefCounterPtr<VirtualBaseSecond> copy = virtual_second;
+    return copy.Get();
+  };
+
+  BENCHMARK("RefCounted interface, copy/destroy through second interface") {
+    RefCounterPtr<InterfaceSecond> copy = interface_second;
+    return copy.Get();
+  };
+
+  BENCHMARK("virtual RefCounter base, copy/destroy through final class") {
+    RefCounterPtr<VirtualBaseObject> copy = virtual_object;
+    return copy.Get();
+  };
+
+  BENCHMARK("RefCounted interface, copy/destroy through final class") {
+    RefCounterPtr<InterfaceObject> copy = interface_object;
+    return copy.Get();
+  };
+
+  BENCHMARK("virtual RefCounter base, create/destroy") {
+    return RefCounterPtr<VirtualBaseSecond>(new VirtualBaseObject)->Second();
+  };
+
+  BENCHMARK("RefCounted interface, create/destroy") {
+    return RefCounterPtr<InterfaceSecond>(new InterfaceObject)->Second();
+  };
+}
+
+TEST_CASE("Benchmark RefCounterCache", "[.][benchmark]") {
+  constexpr int kKeys = 1024;
+  constexpr int kLookups = 10000;
+  std::mutex mutex;
+  std::unordered_map<int, RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>> locked;
+  RefCounterCache<int, BenchmarkObject<ThreadSafeCounter>> cache;
+  for (int key = 0; key < kKeys; ++key) {
+    RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> object(new BenchmarkObject<ThreadSafeCounter>);
+    locked.emplace(key, object);
+    cache.Insert(key, object);
+  }
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("mutex and unordered_map find, " + threads) {
+      RunOnThreads(thread_count, [&] {
+        for (int i = 0; i < kLookups; ++i) {
+          std::lock_guard<std::mutex> lock(mutex);
+          RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> found = locked.find(i % kKeys)->second;
+        }
+      });
+    };
+
+    BENCHMARK("RefCounterCache find, " + threads) {
+      RunOnThreads(thread_count, [&] {
+        for (int i = 0; i < kLookups; ++i)
+          RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> found = cache.Find(i % kKeys);
+      });
+    };
+  }
+}
+
+TEST_CASE("Benchmark Snapshot Read", "[.][benchmark]") {
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> shared(new BenchmarkObject<ThreadSafeCounter>);
+  Snapshot<BenchmarkObject<ThreadSafeCounter>> snapshot(shared);
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("RefCounterPtr copy read, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread; ++i) {
+          RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> copy = shared;
+          sum += copy->value;
+        }
+        sink += sum;
+      });
+      return sink.load();
+    };
+
+    BENCHMARK("Snapshot read, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread; ++i)
+          sum += snapshot.Read()->value;
+        sink += sum;
+      });
+      return sink.load();
+    };
+  }
+
+  BENCHMARK("Snapshot publish") {
+    snapshot.Publish(RefCounterPtr<BenchmarkObject<ThreadSafeCounter>>(new BenchmarkObject<ThreadSafeCounter>));
+  };
+}
+
+TEST_CASE("Benchmark RefCounterRef Call Chain", "[.][benchmark]") {
+  constexpr int kDepth = 16;
+  typedef BenchmarkObject<ThreadSafeCounter> Object;
+  RefCounterPtr<Object> shared(new Object);
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("Ptr by value, depth 16, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread / kDepth; ++i)
+          sum += CallChain<RefCounterPtr<Object>>(shared, kDepth);
+        sink += sum;
+      });
+      return sink.load();
+    };
+
+    BENCHMARK("Ptr const&, depth 16, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread / kDepth; ++i)
+          sum += CallChain<RefCounterPtr<Object> const&>(shared, kDepth);
+        sink += sum;
+      });
+      return sink.load();
+    };
+
+    BENCHMARK("RefCounterRef, depth 16, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread / kDepth; ++i)
+          sum += CallChain<RefCounterRef<Object>>(shared, kDepth);
+        sink += sum;
+      });
+      return sink.load();
+    };
+  }
+}
+
+namespace
+{
+  class ImmortalBenchmarkObject final
+    : public RefCounter<ImmortalCounter<>>
+  {
+  public:
+    ImmortalBenchmarkObject() noexcept
+      : RefCounter(kImmortal)
+    {
+    }
+
+    int value = 0;
+
+  private:
+    void OnFinalDestroy() override {}
+  };
+}
+
+TEST_CASE("Benchmark Immortal Objects", "[.][benchmark]") {
+  static ImmortalBenchmarkObject immortal;
+  RefCounterPtr<BenchmarkObject<ThreadSafeCounter>> counted(new BenchmarkObject<ThreadSafeCounter>);
+  RefCounterPtr<BenchmarkObject<ImmortalCounter<>>> mortal(new BenchmarkObject<ImmortalCounter<>>);
+  RefCounterPtr<ImmortalBenchmarkObject> singleton(&immortal);
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+
+    BENCHMARK("counted copy/destroy, " + threads) {
+      ContendedCopyAndDestroy(counted, thread_count);
+    };
+
+    BENCHMARK("mortal copy/destroy, " + threads) {
+      ContendedCopyAndDestroy(mortal, thread_count);
+    };
+
+    BENCHMARK("immortal copy/destroy, " + threads) {
+      std::atomic<int> sink(0);
+      RunOnThreads(thread_count, [&] {
+        int sum = 0;
+        for (int i = 0; i < kOperationsPerThread; ++i) {
+          RefCounterPtr<ImmortalBenchmarkObject> copy = singleton;
+          sum += copy->value;
+        }
+        sink += sum;
+      });
+      return sink.load();
+    };
+  }
+}
+
+TEST_CASE("Benchmark ParallelRelease", "[.][benchmark]") {
+  constexpr int kReferences = 1000000;
+  typedef BenchmarkObject<ThreadSafeCounter> Object;
+  typedef std::vector<RefCounterPtr<Object>> References;
+
+  // One range per run; every object referenced twice, the copies far apart.
+  auto make_ranges = [](int runs) {
+    std::vector<References> ranges(runs);
+    for (References& references : ranges) {
+      references.reserve(kReferences);
+      for (int i = 0; i < kReferences / 2; ++i)
+        references.push_back(RefCounterPtr<Object>(new Object));
+      for (int i = 0; i < kReferences / 2; ++i)
+        references.push_back(references[i]);
+    }
+    return ranges;
+  };
+
+  BENCHMARK_ADVANCED("vector clear 1000000")(Catch::Benchmark::Chronometer meter) {
+    std::vector<References> ranges = make_ranges(meter.runs());
+    meter.measure([&](int run) { ranges[run].clear(); });
+  };
+
+  for (unsigned int thread_count : BenchmarkThreadCounts()) {
+    std::string threads = std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+    ThreadExecutor executor(thread_count);
+
+    BENCHMARK_ADVANCED("ParallelRelease 1000000, " + threads)(Catch::Benchmark::Chronometer meter) {
+      std::vector<References> ranges = make_ranges(meter.runs());
+      meter.measure([&](int run) { return ParallelRelease(ranges[run], executor); });
+    };
+  }
+}
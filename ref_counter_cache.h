@@ -0,0 +1,265 @@
+#ifndef REF_COUNTER_CACHE_H_
+#define REF_COUNTER_CACHE_H_
+
+#include "ref_counter.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ref_counter
+{
+  namespace detail
+  {
+    // One lock and map per shard, on cache lines of their own. Shards are
+    // picked by the high bits of the mixed hash, so identity hashes such as
+    // that of RefCounterPtr spread too.
+    template<class Key, class Value, class Hash, class KeyEqual, std::size_t ShardCount>
+    class CacheShards
+    {
+      static_assert(ShardCount != 0 && (ShardCount & (ShardCount - 1)) == 0, "shard count must be a power of two");
+
+    public:
+      struct alignas(kCacheLineSize) Shard
+      {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, Value, Hash, KeyEqual> entries;
+      };
+
+      Shard& For(Key const& key) const noexcept
+      {
+        std::uint64_t mixed = static_cast<std::uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+        return m_shards[static_cast<std::size_t>(mixed >> kShift) & (ShardCount - 1)];
+      }
+
+      template<class Function>
+      void ForEach(Function function) const
+      {
+        for (Shard& shard : m_shards)
+          function(shard);
+      }
+
+    private:
+      static constexpr unsigned Bits(std::size_t n) noexcept
+      {
+        return n <= 1 ? 0 : 1 + Bits(n / 2);
+      }
+
+      static constexpr unsigned kShift = ShardCount == 1 ? 0 : 64 - Bits(ShardCount);
+
+      mutable Shard m_shards[ShardCount];
+    };
+  } // namespace detail
+
+  // Concurrent map from Key to shared objects. Lookups take the shared lock
+  // of one of ShardCount shards, inserts and evictions its exclusive lock, so
+  // threads only contend when they hit the same shard, and readers of a
+  // shard never block each other. RefCounterPtr keys work through the
+  // std::hash specialization in ref_counter.h.
+  //
+  // The cache holds one reference to every entry. EvictUnused drops the
+  // entries nobody else holds, i.e. with UseCount() == 1; it runs under the
+  // shard's exclusive lock, so no lookup can copy an entry as it goes.
+  template<class Key, class T, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>, std::size_t ShardCount = 16>
+  class RefCounterCache
+  {
+  public:
+    RefCounterCache() = default;
+
+    RefCounterCache(RefCounterCache const&) = delete;
+    RefCounterCache& operator= (RefCounterCache const&) = delete;
+
+    RefCounterPtr<T> Find(Key const& key) const
+    {
+      Shard& shard = m_shards.For(key);
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.entries.find(key);
+      return it != shard.entries.end() ? it->second : RefCounterPtr<T>();
+    }
+
+    // Inserts value unless key is present and returns the cached object. A
+    // value that lost is released after the lock is left. A null value is
+    // never cached; Insert then only looks the key up.
+    RefCounterPtr<T> Insert(Key const& key, RefCounterPtr<T> value)
+    {
+      if (!value)
+        return Find(key);
+      Shard& shard = m_shards.For(key);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      return shard.entries.try_emplace(key, std::move(value)).first->second;
+    }
+
+    // Returns the cached object or caches create(). create runs without the
+    // lock; when two threads race on one key both may create, and the
+    // first to insert wins. A create() that returns null caches nothing.
+    template<class Factory>
+    RefCounterPtr<T> FindOrCreate(Key const& key, Factory&& create)
+    {
+      if (RefCounterPtr<T> found = Find(key))
+        return found;
+      return Insert(key, std::forward<Factory>(create)());
+    }
+
+    bool Erase(Key const& key)
+    {
+      RefCounterPtr<T> erased;
+      Shard& shard = m_shards.For(key);
+      {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end())
+          return false;
+        erased = std::move(it->second);
+        shard.entries.erase(it);
+      }
+      return true;
+    }
+
+    // Drops every entry only the cache still holds and returns how many.
+    // The objects are released after the shard lock is left.
+    std::size_t EvictUnused()
+    {
+      std::size_t evicted = 0;
+      m_shards.ForEach([&evicted](Shard& shard) {
+        std::vector<RefCounterPtr<T>> unused;
+        {
+          std::unique_lock<std::shared_mutex> lock(shard.mutex);
+          for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if (it->second->UseCount() == 1) {
+              unused.push_back(std::move(it->second));
+              it = shard.entries.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+        evicted += unused.size();
+      });
+      return evicted;
+    }
+
+    std::size_t Size() const
+    {
+      std::size_t size = 0;
+      m_shards.ForEach([&size](Shard const& shard) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        size += shard.entries.size();
+      });
+      return size;
+    }
+
+    void Clear()
+    {
+      m_shards.ForEach([](Shard& shard) {
+        std::unordered_map<Key, RefCounterPtr<T>, Hash, KeyEqual> entries;
+        {
+          std::unique_lock<std::shared_mutex> lock(shard.mutex);
+          entries.swap(shard.entries);
+        }
+      });
+    }
+
+  private:
+    typedef detail::CacheShards<Key, RefCounterPtr<T>, Hash, KeyEqual, ShardCount> Shards;
+    typedef typename Shards::Shard Shard;
+
+    Shards m_shards;
+  };
+
+  // Like RefCounterCache, but entries are weak references, so the cache
+  // never keeps an object alive: Find returns null once the last strong
+  // reference elsewhere is gone. T derives from WeakRefCounter. Expired
+  // entries are replaced by FindOrCreate and Insert, and purged by
+  // EvictExpired.
+  template<class Key, class T, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>, std::size_t ShardCount = 16>
+  class WeakRefCounterCache
+  {
+  public:
+    WeakRefCounterCache() = default;
+
+    WeakRefCounterCache(WeakRefCounterCache const&) = delete;
+    WeakRefCounterCache& operator= (WeakRefCounterCache const&) = delete;
+
+    RefCounterPtr<T> Find(Key const& key) const
+    {
+      Shard& shard = m_shards.For(key);
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.entries.find(key);
+      return it != shard.entries.end() ? it->second.Lock() : RefCounterPtr<T>();
+    }
+
+    // Looks the key up first, so a value that loses to a live entry never
+    // gets a weak reference, and with it a control block.
+    RefCounterPtr<T> Insert(Key const& key, RefCounterPtr<T> value)
+    {
+      Shard& shard = m_shards.For(key);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.entries.find(key);
+      if (it == shard.entries.end()) {
+        shard.entries.emplace(key, RefCounterWeakPtr<T>(value));
+        return value;
+      }
+      if (RefCounterPtr<T> existing = it->second.Lock())
+        return existing;
+      it->second = value;
+      return value;
+    }
+
+    template<class Factory>
+    RefCounterPtr<T> FindOrCreate(Key const& key, Factory&& create)
+    {
+      if (RefCounterPtr<T> found = Find(key))
+        return found;
+      return Insert(key, std::forward<Factory>(create)());
+    }
+
+    bool Erase(Key const& key)
+    {
+      Shard& shard = m_shards.For(key);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      return shard.entries.erase(key) != 0;
+    }
+
+    // Removes the entries whose object is gone and returns how many.
+    std::size_t EvictExpired()
+    {
+      std::size_t evicted = 0;
+      m_shards.ForEach([&evicted](Shard& shard) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+          if (it->second.Expired()) {
+            it = shard.entries.erase(it);
+            ++evicted;
+          } else {
+            ++it;
+          }
+        }
+      });
+      return evicted;
+    }
+
+    // Entries including expired ones not yet evicted.
+    std::size_t Size() const
+    {
+      std::size_t size = 0;
+      m_shards.ForEach([&size](Shard const& shard) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        size += shard.entries.size();
+      });
+      return size;
+    }
+
+  private:
+    typedef detail::CacheShards<Key, RefCounterWeakPtr<T>, Hash, KeyEqual, ShardCount> Shards;
+    typedef typename Shards::Shard Shard;
+
+    Shards m_shards;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_CACHE_H_
@@ -0,0 +1,124 @@
+#include "catch.hpp"
+#include "ref_counter_cache.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using ref_counter::RefCounter;
+using ref_counter::RefCounterCache;
+using ref_counter::RefCounterPtr;
+using ref_counter::WeakRefCounter;
+using ref_counter::WeakRefCounterCache;
+
+class CachedObject
+  : public WeakRefCounter<>
+{
+public:
+  static std::atomic<int> alive;
+
+  explicit CachedObject(int value) : value(value)
+  {
+    ++alive;
+  }
+
+  int value;
+
+protected:
+  virtual ~CachedObject() {
+    --alive;
+  }
+};
+
+std::atomic<int> CachedObject::alive(0);
+
+TEST_CASE("Test RefCounterCache") {
+  RefCounterCache<std::string, CachedObject> cache;
+  CHECK(!cache.Find("a"));
+
+  RefCounterPtr<CachedObject> a = cache.Insert("a", RefCounterPtr<CachedObject>(new CachedObject(1)));
+  CHECK(a->UseCount() == 2);
+  CHECK(cache.Find("a") == a);
+
+  // Insert keeps the cached object.
+  CHECK(cache.Insert("a", RefCounterPtr<CachedObject>(new CachedObject(2))) == a);
+  CHECK(cache.FindOrCreate("b", [] { return RefCounterPtr<CachedObject>(new CachedObject(3)); })->value == 3);
+  CHECK(cache.Size() == 2);
+  CHECK(CachedObject::alive == 2);
+
+  // Only "b" is held by the cache alone.
+  CHECK(cache.EvictUnused() == 1);
+  CHECK(cache.Size() == 1);
+  CHECK(!cache.Find("b"));
+  CHECK(CachedObject::alive == 1);
+
+  // Null values are not cached, so EvictUnused never sees one.
+  CHECK(cache.Insert("a", RefCounterPtr<CachedObject>()) == a);
+  CHECK(!cache.Insert("c", RefCounterPtr<CachedObject>()));
+  CHECK(!cache.FindOrCreate("c", [] { return RefCounterPtr<CachedObject>(); }));
+  CHECK(cache.Size() == 1);
+  CHECK(cache.EvictUnused() == 0);
+
+  a.Reset();
+  CHECK(cache.Erase("a"));
+  CHECK(!cache.Erase("a"));
+  CHECK(CachedObject::alive == 0);
+}
+
+TEST_CASE("Test RefCounterCache Pointer Keys") {
+  RefCounterCache<RefCounterPtr<CachedObject>, CachedObject, std::hash<RefCounterPtr<CachedObject>>, std::equal_to<RefCounterPtr<CachedObject>>, 4> cache;
+  RefCounterPtr<CachedObject> key(new CachedObject(0));
+  cache.Insert(key, RefCounterPtr<CachedObject>(new CachedObject(1)));
+  CHECK(cache.Find(key)->value == 1);
+  cache.Clear();
+  CHECK(cache.Size() == 0);
+  key.Reset();
+  CHECK(CachedObject::alive == 0);
+}
+
+TEST_CASE("Test WeakRefCounterCache") {
+  WeakRefCounterCache<int, CachedObject> cache;
+  RefCounterPtr<CachedObject> one = cache.FindOrCreate(1, [] { return RefCounterPtr<CachedObject>(new CachedObject(1)); });
+  CHECK(one->UseCount() == 1);
+  CHECK(cache.Find(1) == one);
+
+  one.Reset();
+  CHECK(CachedObject::alive == 0);
+  CHECK(!cache.Find(1));
+  CHECK(cache.Size() == 1);
+
+  // An expired entry is replaced.
+  RefCounterPtr<CachedObject> again = cache.Insert(1, RefCounterPtr<CachedObject>(new CachedObject(2)));
+  CHECK(cache.Find(1)->value == 2);
+  again.Reset();
+  CHECK(cache.EvictExpired() == 1);
+  CHECK(cache.Size() == 0);
+}
+
+TEST_CASE("Test RefCounterCache Concurrent") {
+  RefCounterCache<int, CachedObject> cache;
+  std::atomic<int> created(0);
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, &created, &mismatches, t] {
+      for (int i = 0; i < 1000; ++i) {
+        int key = (i * 7 + t) % 64;
+        RefCounterPtr<CachedObject> object = cache.FindOrCreate(key, [&created, key] {
+          ++created;
+          return RefCounterPtr<CachedObject>(new CachedObject(key));
+        });
+        if (object->value != key)
+          ++mismatches;
+        if (i % 100 == 0)
+          cache.EvictUnused();
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  CHECK(mismatches == 0);
+  CHECK(created >= 64);
+  cache.Clear();
+  CHECK(CachedObject::alive == 0);
+}
@@ -0,0 +1,102 @@
+#ifndef REF_COUNTER_CHANNEL_H_
+#define REF_COUNTER_CHANNEL_H_
+
+#include "ref_counter.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <thread>
+
+namespace ref_counter
+{
+  // Bounded single-producer single-consumer channel of references. Items
+  // travel as TransferToken, so handing an object to the consumer thread
+  // touches neither its count nor the allocator; the only atomics are the
+  // two ring indices, which each side caches to avoid reading the other's
+  // line on every call. Null references can not be sent.
+  template<class T, std::size_t Capacity = 1024>
+  class RefCounterChannel
+  {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+  public:
+    RefCounterChannel() noexcept = default;
+
+    RefCounterChannel(RefCounterChannel const&) = delete;
+    RefCounterChannel& operator= (RefCounterChannel const&) = delete;
+
+    // Releases what nobody received.
+    ~RefCounterChannel() {
+      while (TransferToken<T> token = TryReceive())
+        static_cast<void>(token.Adopt());
+    }
+
+    // Producer side. Moves from token and returns true unless the channel is
+    // full, in which case token is left as it was.
+    bool TrySend(TransferToken<T>& token) noexcept
+    {
+      assert(token && "null reference sent");
+      std::size_t head = m_head.load(std::memory_order_relaxed);
+      if (head - m_cached_tail == Capacity) {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if (head - m_cached_tail == Capacity)
+          return false;
+      }
+      m_slots[head & (Capacity - 1)] = static_cast<TransferToken<T>&&>(token);
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Waits while the channel is full.
+    void Send(TransferToken<T> token) noexcept
+    {
+      while (!TrySend(token))
+        std::this_thread::yield();
+    }
+
+    void Send(RefCounterPtr<T>&& p) noexcept
+    {
+      Send(p.Release());
+    }
+
+    // Consumer side. An empty token when there is nothing to receive.
+    TransferToken<T> TryReceive() noexcept
+    {
+      std::size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail == m_cached_head) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        if (tail == m_cached_head)
+          return TransferToken<T>();
+      }
+      TransferToken<T> token(static_cast<TransferToken<T>&&>(m_slots[tail & (Capacity - 1)]));
+      m_tail.store(tail + 1, std::memory_order_release);
+      return token;
+    }
+
+    // Waits for the next item.
+    RefCounterPtr<T> Receive() noexcept
+    {
+      for (;;) {
+        if (TransferToken<T> token = TryReceive())
+          return token.Adopt();
+        std::this_thread::yield();
+      }
+    }
+
+    // Only a snapshot while the other side is active.
+    std::size_t Size() const noexcept
+    {
+      return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    alignas(kCacheLineSize) std::atomic<std::size_t> m_head{ 0 };
+    std::size_t m_cached_tail = 0;
+    alignas(kCacheLineSize) std::atomic<std::size_t> m_tail{ 0 };
+    std::size_t m_cached_head = 0;
+    alignas(kCacheLineSize) TransferToken<T> m_slots[Capacity];
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_CHANNEL_H_
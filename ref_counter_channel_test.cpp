@@ -0,0 +1,74 @@
+#include "catch.hpp"
+#include "ref_counter_channel.h"
+#include "ref_counter_test_fixtures.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::RefCounterChannel;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::TransferToken;
+
+namespace
+{
+  typedef ref_counter_test::CountingCounter<ThreadSafeCounter> CountingCounter;
+  typedef ref_counter_test::Payload<CountingCounter> Message;
+}
+
+TEST_CASE("Test RefCounterChannel") {
+  {
+    RefCounterChannel<Message, 4> channel;
+    CHECK(!channel.TryReceive());
+
+    for (int i = 0; i < 4; ++i)
+      channel.Send(RefCounterPtr<Message>(new Message(i)));
+    CHECK(channel.Size() == 4);
+
+    // A full channel leaves the token with the caller.
+    TransferToken<Message> extra = RefCounterPtr<Message>(new Message(4)).Release();
+    CHECK(!channel.TrySend(extra));
+    CHECK(extra);
+
+    for (int i = 0; i < 4; ++i) {
+      TransferToken<Message> token = channel.TryReceive();
+      REQUIRE(token);
+      RefCounterPtr<Message> message = token.Adopt();
+      CHECK(message->value == i);
+      CHECK(message->UseCount() == 1);
+    }
+    CHECK(channel.TrySend(extra));
+    CHECK(!extra);
+    CHECK(channel.Size() == 1);
+  }
+  // The channel released the message nobody received.
+  CHECK(Message::alive == 0);
+}
+
+TEST_CASE("Test RefCounterChannel Between Threads") {
+  constexpr int kMessages = 100000;
+  RefCounterChannel<Message, 64> channel;
+  std::vector<RefCounterPtr<Message>> messages;
+  for (int i = 0; i < kMessages; ++i)
+    messages.push_back(RefCounterPtr<Message>(new Message(i)));
+
+  int before = CountingCounter::Updates();
+  std::thread producer([&] {
+    for (RefCounterPtr<Message>& message : messages)
+      channel.Send(std::move(message));
+  });
+  std::vector<RefCounterPtr<Message>> received;
+  received.reserve(kMessages);
+  for (int i = 0; i < kMessages; ++i)
+    received.push_back(channel.Receive());
+  producer.join();
+
+  // Ownership moved through the channel without a single count update.
+  CHECK(CountingCounter::Updates() == before);
+  bool in_order = true;
+  for (int i = 0; i < kMessages; ++i)
+    in_order = in_order && received[i]->value == i && received[i]->UseCount() == 1;
+  CHECK(in_order);
+  received.clear();
+  CHECK(Message::alive == 0);
+}
@@ -0,0 +1,335 @@
+#ifndef REF_COUNTER_COROUTINE_H_
+#define REF_COUNTER_COROUTINE_H_
+
+#include "ref_counter.h"
+#include "ref_counter_pool.h"
+
+// C++20 coroutine support; empty when the compiler has none, so other
+// headers may include this one unconditionally.
+#ifndef REF_COUNTER_HAS_COROUTINES
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define REF_COUNTER_HAS_COROUTINES 1
+#else
+#define REF_COUNTER_HAS_COROUTINES 0
+#endif
+#endif
+
+#if REF_COUNTER_HAS_COROUTINES
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace ref_counter
+{
+  template<class T = void> class RefTask;
+
+  namespace detail
+  {
+    // The promise, and with it the whole frame, is the counted object. The
+    // RefTask handles hold references, and so does the coroutine itself
+    // from the moment it is started until its final suspension, which lets
+    // a started task finish after every handle is gone. The last release
+    // destroys the frame through OnFinalDestroy; frames come from
+    // RefCounterPool.
+    template<class Promise>
+    class RefTaskPromiseBase
+      : public RefCounterBase<Promise>
+    {
+    public:
+      static void* operator new(std::size_t size) {
+        return RefCounterPool::Allocate(size);
+      }
+
+      static void operator delete(void* p, std::size_t size) noexcept {
+        RefCounterPool::Deallocate(p, size);
+      }
+
+      // Lazy: the body runs on Start or on the first co_await.
+      std::suspend_always initial_suspend() noexcept {
+        return {};
+      }
+
+      auto final_suspend() noexcept {
+        struct FinalAwaiter
+        {
+          bool await_ready() noexcept {
+            return false;
+          }
+
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            Promise& promise = handle.promise();
+            void* waiter = promise.m_waiter.exchange(&promise, std::memory_order_acq_rel);
+            // May destroy the frame; nothing of it is touched afterwards.
+            promise.Decrement();
+            return waiter != nullptr ? std::coroutine_handle<>::from_address(waiter) : std::noop_coroutine();
+          }
+
+          void await_resume() noexcept {}
+        };
+        return FinalAwaiter();
+      }
+
+      void unhandled_exception() noexcept {
+        m_exception = std::current_exception();
+      }
+
+      bool Done() const noexcept {
+        return m_waiter.load(std::memory_order_acquire) == this;
+      }
+
+      // Takes the coroutine's own reference and resumes it. Returns false
+      // if it was started already.
+      bool Start() noexcept {
+        if (m_started)
+          return false;
+        m_started = true;
+        this->Increment();
+        Handle().resume();
+        return true;
+      }
+
+      // Prepares waiter to be resumed on completion and returns what to
+      // resume now: this coroutine if it was not started, nothing if it is
+      // running, waiter itself if it has finished.
+      std::coroutine_handle<> Await(std::coroutine_handle<> waiter) noexcept {
+        if (!m_started) {
+          m_started = true;
+          this->Increment();
+          m_waiter.store(waiter.address(), std::memory_order_relaxed);
+          return Handle();
+        }
+        void* expected = nullptr;
+        if (m_waiter.compare_exchange_strong(expected, waiter.address(), std::memory_order_acq_rel, std::memory_order_acquire))
+          return std::noop_coroutine();
+        return waiter;
+      }
+
+      void RethrowIfFailed() const {
+        if (m_exception)
+          std::rethrow_exception(m_exception);
+      }
+
+    private:
+      friend class RefCounterBase<Promise>;
+
+      std::coroutine_handle<Promise> Handle() noexcept {
+        return std::coroutine_handle<Promise>::from_promise(static_cast<Promise&>(*this));
+      }
+
+      void OnFinalDestroy() {
+        Handle().destroy();
+      }
+
+      // The awaiting coroutine, or this promise once the body has finished.
+      std::atomic<void*> m_waiter{ nullptr };
+      std::exception_ptr m_exception;
+      bool m_started = false;
+    };
+
+    template<class T>
+    class RefTaskPromise
+      : public RefTaskPromiseBase<RefTaskPromise<T>>
+    {
+    public:
+      RefTask<T> get_return_object() noexcept;
+
+      template<class U = T>
+      void return_value(U&& value) {
+        m_value.emplace(std::forward<U>(value));
+      }
+
+      T& Value() {
+        this->RethrowIfFailed();
+        return *m_value;
+      }
+
+    private:
+      std::optional<T> m_value;
+    };
+
+    template<>
+    class RefTaskPromise<void>
+      : public RefTaskPromiseBase<RefTaskPromise<void>>
+    {
+    public:
+      RefTask<void> get_return_object() noexcept;
+
+      void return_void() noexcept {}
+
+      void Value() {
+        RethrowIfFailed();
+      }
+    };
+  } // namespace detail
+
+  // Lazily started coroutine task whose frame is reference counted, see
+  // RefTaskPromiseBase. `co_await std::move(task)` moves the result out, so
+  // a RefCounterPtr result crosses the suspension without a count update;
+  // awaiting an lvalue task returns a reference to the result. A task may
+  // be awaited by one coroutine. Start runs one that nobody awaits; it then
+  // finishes on its own and Done and Result report the outcome.
+  //
+  // Keep RefCounterPtr locals of the body alive across co_await by value in
+  // the frame rather than copying them into awaiters: a coroutine resumed
+  // on another thread touches none of their counts.
+  template<class T>
+  class [[nodiscard]] RefTask
+  {
+  public:
+    typedef detail::RefTaskPromise<T> promise_type;
+
+    RefTask() noexcept = default;
+
+    explicit RefTask(RefCounterPtr<promise_type> promise) noexcept
+      : m_promise(std::move(promise))
+    {
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return static_cast<bool>(m_promise);
+    }
+
+    bool Done() const noexcept
+    {
+      return m_promise && m_promise->Done();
+    }
+
+    bool Start() noexcept
+    {
+      assert(m_promise);
+      return m_promise->Start();
+    }
+
+    // The result of a finished task; rethrows what escaped from the body.
+    decltype(auto) Result() &
+    {
+      assert(Done());
+      return m_promise->Value();
+    }
+
+    decltype(auto) Result() &&
+    {
+      assert(Done());
+      if constexpr (std::is_void<T>::value)
+        return m_promise->Value();
+      else
+        return T(std::move(m_promise->Value()));
+    }
+
+    auto operator co_await() & noexcept
+    {
+      return Awaiter<false>{ m_promise.Get() };
+    }
+
+    auto operator co_await() && noexcept
+    {
+      return Awaiter<true>{ m_promise.Get() };
+    }
+
+  private:
+    template<bool Move>
+    struct Awaiter
+    {
+      promise_type* promise;
+
+      bool await_ready() const noexcept {
+        return promise->Done();
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept {
+        return promise->Await(waiter);
+      }
+
+      decltype(auto) await_resume() {
+        if constexpr (std::is_void<T>::value)
+          return promise->Value();
+        else if constexpr (Move)
+          return T(std::move(promise->Value()));
+        else
+          return static_cast<T&>(promise->Value());
+      }
+    };
+
+    RefCounterPtr<promise_type> m_promise;
+  };
+
+  namespace detail
+  {
+    template<class T>
+    RefTask<T> RefTaskPromise<T>::get_return_object() noexcept
+    {
+      return RefTask<T>(RefCounterPtr<RefTaskPromise<T>>(this));
+    }
+
+    inline RefTask<void> RefTaskPromise<void>::get_return_object() noexcept
+    {
+      return RefTask<void>(RefCounterPtr<RefTaskPromise<void>>(this));
+    }
+  } // namespace detail
+
+  // One-shot handoff of a reference to an awaiting coroutine: Set moves the
+  // pointer in, `co_await handoff` moves it out, and the count is never
+  // touched in between. Set resumes a coroutine that is already waiting on
+  // the calling thread. One producer, one consumer; the handoff must
+  // outlive both.
+  template<class T>
+  class RefCounterHandoff
+  {
+  public:
+    RefCounterHandoff() noexcept = default;
+
+    RefCounterHandoff(RefCounterHandoff const&) = delete;
+    RefCounterHandoff& operator= (RefCounterHandoff const&) = delete;
+
+    void Set(RefCounterPtr<T> value) noexcept
+    {
+      m_value = std::move(value);
+      void* waiter = m_waiter.exchange(this, std::memory_order_acq_rel);
+      if (waiter != nullptr)
+        std::coroutine_handle<>::from_address(waiter).resume();
+    }
+
+    bool Ready() const noexcept
+    {
+      return m_waiter.load(std::memory_order_acquire) == this;
+    }
+
+    auto operator co_await() noexcept
+    {
+      struct Awaiter
+      {
+        RefCounterHandoff* handoff;
+
+        bool await_ready() const noexcept {
+          return handoff->Ready();
+        }
+
+        bool await_suspend(std::coroutine_handle<> waiter) noexcept {
+          void* expected = nullptr;
+          return handoff->m_waiter.compare_exchange_strong(expected, waiter.address(), std::memory_order_acq_rel, std::memory_order_acquire);
+        }
+
+        RefCounterPtr<T> await_resume() noexcept {
+          return std::move(handoff->m_value);
+        }
+      };
+      return Awaiter{ this };
+    }
+
+  private:
+    // The waiting coroutine, or this handoff once the value is set.
+    std::atomic<void*> m_waiter{ nullptr };
+    RefCounterPtr<T> m_value;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_HAS_COROUTINES
+
+#endif // REF_COUNTER_COROUTINE_H_
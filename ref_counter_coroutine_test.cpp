@@ -0,0 +1,127 @@
+#include "catch.hpp"
+#include "ref_counter_coroutine.h"
+#include "ref_counter_test_fixtures.h"
+
+#if REF_COUNTER_HAS_COROUTINES
+
+#include <stdexcept>
+#include <thread>
+
+using ref_counter::RefCounterHandoff;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefTask;
+using ref_counter::ThreadSafeCounter;
+
+namespace
+{
+  typedef ref_counter_test::CountingCounter<ThreadSafeCounter> CountingCounter;
+  typedef ref_counter_test::Payload<CountingCounter> Payload;
+
+  RefTask<int> Add(int a, int b)
+  {
+    co_return a + b;
+  }
+
+  RefTask<int> Sum(int n)
+  {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+      sum += co_await Add(i, 1);
+    co_return sum;
+  }
+
+  RefTask<RefCounterPtr<Payload>> Receive(RefCounterHandoff<Payload>& handoff)
+  {
+    RefCounterPtr<Payload> payload = co_await handoff;
+    co_return payload;
+  }
+
+  RefTask<int> Forward(RefCounterHandoff<Payload>& handoff)
+  {
+    RefCounterPtr<Payload> payload = co_await Receive(handoff);
+    co_return payload->value;
+  }
+
+  RefTask<> Hold(RefCounterPtr<Payload> payload, RefCounterHandoff<Payload>& handoff)
+  {
+    RefCounterPtr<Payload> other = co_await handoff;
+    payload->value += other->value;
+  }
+
+  RefTask<int> Fail()
+  {
+    throw std::runtime_error("failed");
+    co_return 0;
+  }
+}
+
+TEST_CASE("Test RefTask") {
+  RefTask<int> task = Sum(10);
+  CHECK(!task.Done());
+  CHECK(task.Start());
+  CHECK(!task.Start());
+  REQUIRE(task.Done());
+  CHECK(task.Result() == 55);
+
+  RefTask<int> failing = Fail();
+  failing.Start();
+  CHECK_THROWS_AS(failing.Result(), std::runtime_error);
+}
+
+TEST_CASE("Test RefTask Frame Lifetime") {
+  RefCounterHandoff<Payload> handoff;
+  RefCounterPtr<Payload> payload(new Payload(1));
+
+  // A task that never ran gives its parameters back with the last handle.
+  {
+    RefTask<> unstarted = Hold(payload, handoff);
+    CHECK(payload->UseCount() == 2);
+  }
+  CHECK(payload->UseCount() == 1);
+
+  // A started task keeps its frame until it finishes.
+  {
+    RefTask<> started = Hold(payload, handoff);
+    started.Start();
+    CHECK(!started.Done());
+  }
+  CHECK(payload->UseCount() == 2);
+  handoff.Set(RefCounterPtr<Payload>(new Payload(2)));
+  CHECK(payload->UseCount() == 1);
+  CHECK(payload->value == 3);
+  payload.Reset();
+  CHECK(Payload::alive == 0);
+}
+
+TEST_CASE("Test RefTask Moves References Across Threads") {
+  RefCounterHandoff<Payload> handoff;
+  RefTask<int> task = Forward(handoff);
+  task.Start();
+  CHECK(!task.Done());
+
+  // Created with one increment; the handoff, the inner task's result and
+  // the resumption on another thread move it without further updates.
+  int before = CountingCounter::Updates();
+  std::thread producer([&] {
+    handoff.Set(RefCounterPtr<Payload>(new Payload(7)));
+  });
+  producer.join();
+  REQUIRE(task.Done());
+  CHECK(task.Result() == 7);
+  CHECK(Payload::alive == 0);
+  CHECK(CountingCounter::Updates() - before == 2);
+}
+
+TEST_CASE("Test RefCounterHandoff Set Before Await") {
+  RefCounterHandoff<Payload> handoff;
+  handoff.Set(RefCounterPtr<Payload>(new Payload(5)));
+  CHECK(handoff.Ready());
+  RefTask<RefCounterPtr<Payload>> task = Receive(handoff);
+  task.Start();
+  REQUIRE(task.Done());
+  RefCounterPtr<Payload> payload = std::move(task).Result();
+  CHECK(payload->value == 5);
+  CHECK(payload->UseCount() == 1);
+}
+
+#endif // REF_COUNTER_HAS_COROUTINES
@@ -0,0 +1,124 @@
+#ifndef REF_COUNTER_COW_H_
+#define REF_COUNTER_COW_H_
+
+#include "ref_counter.h"
+#include <utility>
+
+namespace ref_counter
+{
+  // Copy-on-write handle over a shared, otherwise immutable T. Reads go
+  // straight to the shared object; Mutate copies it first when anyone else
+  // holds a reference and writes in place when this handle is the only one.
+  // The clone uses T's copy constructor.
+  //
+  // Uniqueness comes from T::IsUnique, not UseCount() == 1: with policies
+  // such as BiasedCounter the count is only a lower bound on some threads,
+  // and IsUnique answers false there so Mutate clones. For ThreadSafeCounter
+  // it is an acquire load that pairs with the release decrements, so once it
+  // reads 1 every write made through the other, now dropped, references is
+  // visible and nobody can add one. That does not hold for weak references,
+  // which can be locked at any time: do not use CowPtr with objects that
+  // have RefCounterWeakPtr observers.
+  template<class T>
+  class CowPtr
+  {
+  public:
+    CowPtr() noexcept = default;
+
+    explicit CowPtr(RefCounterPtr<T> p) noexcept
+      : m_ptr(std::move(p))
+    {
+    }
+
+    T const* Get() const noexcept
+    {
+      return m_ptr.Get();
+    }
+
+    T const& operator*() const noexcept
+    {
+      return *m_ptr;
+    }
+
+    T const* operator->() const noexcept
+    {
+      return m_ptr.Get();
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return static_cast<bool>(m_ptr);
+    }
+
+    bool IsUnique() const noexcept
+    {
+      return m_ptr && m_ptr->IsUnique();
+    }
+
+    // Writable access, cloning first if the object is shared.
+    T& Mutate()
+    {
+      assert(m_ptr);
+      if (!IsUnique())
+        m_ptr = RefCounterPtr<T>(new T(*m_ptr));
+      return *m_ptr;
+    }
+
+    // Applies f to a writable object and returns the result. On an lvalue
+    // the original stays untouched and the object is cloned; on an rvalue
+    // the handle moves along, so a chain such as
+    // `std::move(cow).Transform(f).Transform(g)` clones at most once.
+    template<class Function>
+    CowPtr Transform(Function&& f) const&
+    {
+      CowPtr copy(*this);
+      std::forward<Function>(f)(copy.Mutate());
+      return copy;
+    }
+
+    template<class Function>
+    CowPtr Transform(Function&& f) &&
+    {
+      std::forward<Function>(f)(Mutate());
+      return std::move(*this);
+    }
+
+    // The shared object, for code that only reads it; writing through the
+    // result bypasses the copy on write.
+    RefCounterPtr<T> Share() const&
+    {
+      return m_ptr;
+    }
+
+    RefCounterPtr<T> Share() && noexcept
+    {
+      return std::move(m_ptr);
+    }
+
+    void Reset()
+    {
+      m_ptr.Reset();
+    }
+
+    void swap(CowPtr& rhs) noexcept
+    {
+      m_ptr.swap(rhs.m_ptr);
+    }
+
+  private:
+    RefCounterPtr<T> m_ptr;
+  };
+
+  template<class T> void swap(CowPtr<T>& lhs, CowPtr<T>& rhs) noexcept
+  {
+    lhs.swap(rhs);
+  }
+
+  template<class T, class... Args> CowPtr<T> MakeCow(Args&&... args)
+  {
+    return CowPtr<T>(RefCounterPtr<T>(new T(std::forward<Args>(args)...)));
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_COW_H_
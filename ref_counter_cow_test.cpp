@@ -0,0 +1,144 @@
+#include "catch.hpp"
+#include "ref_counter_cow.h"
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using ref_counter::BiasedCounter;
+using ref_counter::CowPtr;
+using ref_counter::MakeCow;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+
+class Buffer
+  : public RefCounter<>
+{
+public:
+  static int copies;
+
+  explicit Buffer(std::string text)
+    : text(std::move(text))
+  {
+  }
+
+  Buffer(Buffer const& rhs)
+    : RefCounter<>(rhs)
+    , text(rhs.text)
+  {
+    ++copies;
+  }
+
+  std::string text;
+};
+
+int Buffer::copies = 0;
+
+class BiasedBuffer
+  : public RefCounter<BiasedCounter>
+{
+public:
+  explicit BiasedBuffer(std::string text)
+    : text(std::move(text))
+  {
+  }
+
+  BiasedBuffer(BiasedBuffer const& rhs)
+    : RefCounter<BiasedCounter>(rhs)
+    , text(rhs.text)
+  {
+  }
+
+  std::string text;
+};
+
+TEST_CASE("Test CowPtr") {
+  Buffer::copies = 0;
+  CowPtr<Buffer> original = MakeCow<Buffer>("abc");
+  CHECK(original.IsUnique());
+
+  // Unique: written in place.
+  Buffer const* before = original.Get();
+  original.Mutate().text += "d";
+  CHECK(original.Get() == before);
+  CHECK(Buffer::copies == 0);
+
+  // Shared: the writer gets its own copy, the other handle is unchanged.
+  CowPtr<Buffer> copy = original;
+  CHECK(!copy.IsUnique());
+  copy.Mutate().text += "e";
+  CHECK(Buffer::copies == 1);
+  CHECK(original->text == "abcd");
+  CHECK(copy->text == "abcde");
+  CHECK(original.IsUnique());
+  CHECK(copy.IsUnique());
+
+  RefCounterPtr<Buffer> reader = copy.Share();
+  CHECK(!copy.IsUnique());
+  reader.Reset();
+  CHECK(copy.IsUnique());
+}
+
+TEST_CASE("Test CowPtr Transform Chain") {
+  Buffer::copies = 0;
+  auto append = [](char c) { return [c](Buffer& buffer) { buffer.text += c; }; };
+
+  CowPtr<Buffer> result = MakeCow<Buffer>("").Transform(append('x')).Transform(append('y')).Transform(append('z'));
+  CHECK(result->text == "xyz");
+  CHECK(Buffer::copies == 0);
+
+  // From an lvalue the first step clones, the rest of the chain does not.
+  CowPtr<Buffer> derived = result.Transform(append('1')).Transform(append('2'));
+  CHECK(Buffer::copies == 1);
+  CHECK(result->text == "xyz");
+  CHECK(derived->text == "xyz12");
+
+  CowPtr<Buffer> moved = std::move(derived).Transform(append('3'));
+  CHECK(Buffer::copies == 1);
+  CHECK(moved->text == "xyz123");
+}
+
+TEST_CASE("Test CowPtr Across Threads") {
+  Buffer::copies = 0;
+  CowPtr<Buffer> shared = MakeCow<Buffer>("base");
+  std::vector<CowPtr<Buffer>> results(4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&results, i, copy = shared]() mutable {
+      copy.Mutate().text += std::to_string(i);
+      results[i] = std::move(copy);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  CHECK(shared->text == "base");
+  for (int i = 0; i < 4; ++i)
+    CHECK(results[i]->text == "base" + std::to_string(i));
+}
+
+TEST_CASE("Test CowPtr With BiasedCounter") {
+  // The owner thread keeps a biased reference. On another thread the count
+  // reads 1, but the handle there is not the only one and must clone.
+  CowPtr<BiasedBuffer> owner = MakeCow<BiasedBuffer>("base");
+  RefCounterPtr<BiasedBuffer> shared = owner.Share();
+  bool unique = true;
+  bool cloned = false;
+  std::thread([&]() {
+    CowPtr<BiasedBuffer> other(shared);
+    unique = other.IsUnique();
+    BiasedBuffer const* before = other.Get();
+    other.Mutate().text += "!";
+    cloned = other.Get() != before;
+  }).join();
+  CHECK(!unique);
+  CHECK(cloned);
+  CHECK(owner->text == "base");
+
+  // On the owner thread the count is exact.
+  shared.Reset();
+  CHECK(owner.IsUnique());
+  BiasedBuffer const* before = owner.Get();
+  owner.Mutate().text += "?";
+  CHECK(owner.Get() == before);
+  CHECK(owner->text == "base?");
+}
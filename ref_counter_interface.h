@@ -0,0 +1,54 @@
+#ifndef REF_COUNTER_INTERFACE_H_
+#define REF_COUNTER_INTERFACE_H_
+
+#include "ref_counter.h"
+
+namespace ref_counter
+{
+  // COM-style root for interfaces, the alternative to deriving interfaces
+  // from `virtual public RefCounter<...>`. Interfaces derive from it
+  // non-virtually and the most-derived class implements the count once,
+  // usually through RefCountedImpl. A RefCounterPtr to an interface then
+  // reaches the count with one virtual call instead of a virtual-base
+  // adjustment, and one to a final implementation class needs no indirect
+  // call at all.
+  class RefCounted
+  {
+  public:
+    virtual void Increment() noexcept = 0;
+    virtual void Decrement() = 0;
+
+  protected:
+    ~RefCounted() = default;
+  };
+
+  // Implements every RefCounted in Interfaces with a single count of
+  // CounterPolicy. The counting itself is RefCounter's, so OnFinalDestroy,
+  // ReleaseChildren and deferred release work as they do there. Declare the
+  // most-derived class final to let calls through it be devirtualized.
+  template<typename CounterPolicy, class... Interfaces>
+  class RefCountedImpl
+    : public Interfaces...
+    , protected RefCounter<CounterPolicy>
+  {
+  public:
+    typedef typename RefCounter<CounterPolicy>::CountType CountType;
+
+    void Increment() noexcept final {
+      RefCounter<CounterPolicy>::Increment();
+    }
+
+    void Decrement() final {
+      RefCounter<CounterPolicy>::Decrement();
+    }
+
+    using RefCounter<CounterPolicy>::UseCount;
+
+  protected:
+    RefCountedImpl() = default;
+    virtual ~RefCountedImpl() = default;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_INTERFACE_H_
@@ -0,0 +1,109 @@
+#include "catch.hpp"
+#include "ref_counter_interface.h"
+#include <string>
+#include <type_traits>
+
+using ref_counter::MakeRef;
+using ref_counter::RefCounted;
+using ref_counter::RefCountedImpl;
+using ref_counter::RefCounterPtr;
+using ref_counter::ReleaseWorklist;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter;
+using ref_counter::static_pointer_cast;
+
+class IReader
+  : public RefCounted
+{
+public:
+  virtual std::string Read() = 0;
+};
+
+class IWriter
+  : public RefCounted
+{
+public:
+  virtual void Write(std::string text) = 0;
+};
+
+class Document final
+  : public RefCountedImpl<ThreadSafeCounter, IReader, IWriter>
+{
+public:
+  static int alive;
+
+  Document()
+  {
+    ++alive;
+  }
+
+  virtual std::string Read() override { return m_text; }
+  virtual void Write(std::string text) override { m_text += text; }
+
+private:
+  ~Document() {
+    --alive;
+  }
+
+  std::string m_text;
+};
+
+int Document::alive = 0;
+
+TEST_CASE("Test RefCounted Interfaces") {
+  static_assert(!std::is_base_of<ref_counter::RefCounter<ThreadSafeCounter>, IReader>::value, "interfaces carry no count");
+  {
+    RefCounterPtr<Document> document = MakeRef<Document>();
+    RefCounterPtr<IWriter> writer(document);
+    RefCounterPtr<IReader> reader(document);
+    CHECK(document->UseCount() == 3);
+    writer->Write("abc");
+    CHECK(reader->Read() == "abc");
+
+    // Both interface pointers count on the same object.
+    document.Reset();
+    writer.Reset();
+    CHECK(Document::alive == 1);
+    RefCounterPtr<Document> back = static_pointer_cast<Document>(reader);
+    CHECK(back->UseCount() == 2);
+  }
+  CHECK(Document::alive == 0);
+}
+
+class ListItem final
+  : public RefCountedImpl<ThreadUnsafeCounter, IReader>
+{
+public:
+  static int alive;
+
+  explicit ListItem(RefCounterPtr<ListItem> next) : next(std::move(next))
+  {
+    ++alive;
+  }
+
+  virtual std::string Read() override { return next ? "item " + next->Read() : "item"; }
+
+  RefCounterPtr<ListItem> next;
+
+private:
+  ~ListItem() {
+    --alive;
+  }
+
+  virtual void ReleaseChildren(ReleaseWorklist& children) override {
+    children.Add(next);
+  }
+};
+
+int ListItem::alive = 0;
+
+TEST_CASE("Test RefCounted Iterative Release") {
+  RefCounterPtr<ListItem> head;
+  for (int i = 0; i < 100000; ++i)
+    head = RefCounterPtr<ListItem>(new ListItem(std::move(head)));
+  RefCounterPtr<IReader> reader(head);
+  head.Reset();
+  CHECK(ListItem::alive == 100000);
+  reader.Reset();
+  CHECK(ListItem::alive == 0);
+}
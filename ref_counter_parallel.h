@@ -0,0 +1,216 @@
+#ifndef REF_COUNTER_PARALLEL_H_
+#define REF_COUNTER_PARALLEL_H_
+
+#include "ref_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace ref_counter
+{
+  // Fork-join executor for ParallelRelease. ForEach runs function(0) to
+  // function(count - 1) on up to Concurrency() threads, the calling one
+  // included, and returns when all have finished. Threads claim the next
+  // index from a shared cursor, so one slow task does not hold up the rest.
+  // Any type with the same two members can take its place, e.g. an adapter
+  // over an application thread pool.
+  class ThreadExecutor
+  {
+  public:
+    explicit ThreadExecutor(unsigned int thread_count = std::thread::hardware_concurrency()) noexcept
+      : m_thread_count(thread_count == 0 ? 1 : thread_count)
+    {
+    }
+
+    unsigned int Concurrency() const noexcept
+    {
+      return m_thread_count;
+    }
+
+    template<class Function>
+    void ForEach(std::size_t count, Function function) const
+    {
+      std::atomic<std::size_t> next{ 0 };
+      auto work = [&] {
+        for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+          function(i);
+      };
+      std::size_t helpers = std::min<std::size_t>(m_thread_count, count);
+      Joiner threads;
+      try {
+        threads.reserve(helpers > 0 ? helpers - 1 : 0);
+        for (std::size_t i = 1; i < helpers; ++i)
+          threads.emplace_back(work);
+      } catch (...) {
+        // Out of threads or memory: the helpers already running and this
+        // thread take the rest.
+      }
+      work();
+    }
+
+  private:
+    // Joins the helpers however ForEach is left, since destroying a
+    // joinable std::thread terminates.
+    struct Joiner
+      : std::vector<std::thread>
+    {
+      ~Joiner() {
+        for (std::thread& thread : *this)
+          thread.join();
+      }
+    };
+
+    unsigned int m_thread_count;
+  };
+
+  namespace detail
+  {
+    template<class T>
+    void DropReferences(T* p, std::size_t n)
+    {
+      typedef typename T::CountType CountType;
+      while (n > 0) {
+        CountType step = n > std::numeric_limits<CountType>::max() ? std::numeric_limits<CountType>::max() : static_cast<CountType>(n);
+        p->Decrement(step);
+        n -= step;
+      }
+    }
+
+    // Drops the references in [first, last) with one bulk decrement per run
+    // of equal pointers. Returns the number of runs.
+    template<class T>
+    std::size_t DropReferenceRuns(T* const* first, T* const* last)
+    {
+      std::size_t runs = 0;
+      while (first != last) {
+        T* const* run_end = std::find_if(first, last, [p = *first](T* q) { return q != p; });
+        DropReferences(*first, static_cast<std::size_t>(run_end - first));
+        ++runs;
+        first = run_end;
+      }
+      return runs;
+    }
+
+    template<class T>
+    std::size_t DropReferences(std::vector<T*>& pointers, bool sort)
+    {
+      if (sort)
+        std::sort(pointers.begin(), pointers.end(), std::less<T*>());
+      return DropReferenceRuns(pointers.data(), pointers.data() + pointers.size());
+    }
+
+    inline std::size_t PointerBucket(void const* p, std::size_t buckets) noexcept
+    {
+      std::uint64_t mixed = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p)) * 0x9E3779B97F4A7C15ull;
+      return static_cast<std::size_t>((mixed >> 32) % buckets);
+    }
+  } // namespace detail
+
+  // How ParallelRelease merges references to the same object into one bulk
+  // decrement. Adjacent merges runs of equal pointers, which costs nothing
+  // extra. All merges every reference in the range by sorting, which costs
+  // more than the decrements it saves unless the objects' counts are
+  // contended by other threads meanwhile.
+  enum class ReleaseGrouping
+  {
+    Adjacent,
+    All,
+  };
+
+  // Drops every reference in [first, last), leaving the RefCounterPtr there
+  // null, and returns the number of decrements made. References are spread
+  // over the executor's threads by pointee, so each object is handled by
+  // one thread and its count never bounces between the workers, and the
+  // final destroys of different objects run in parallel. Ranges below
+  // min_parallel_size are released on the calling thread.
+  //
+  // Objects dropped to zero are destroyed on an executor thread, with that
+  // thread's deferred-release sink and ReleaseWorklist. Policies must
+  // tolerate decrements from another thread, which rules out
+  // ThreadUnsafeCounter unless nothing else references the objects.
+  template<class Iterator, class Executor>
+  std::size_t ParallelRelease(Iterator first, Iterator last, Executor const& executor, ReleaseGrouping grouping = ReleaseGrouping::Adjacent, std::size_t min_parallel_size = 1u << 14)
+  {
+    static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>::value, "ParallelRelease needs random access iterators");
+    typedef typename std::remove_pointer<decltype((*first).Get())>::type T;
+
+    std::size_t size = static_cast<std::size_t>(last - first);
+    std::size_t workers = executor.Concurrency();
+    bool sort = grouping == ReleaseGrouping::All;
+    if ((size < min_parallel_size || workers < 2) && !sort) {
+      std::size_t runs = 0;
+      for (Iterator it = first; it != last;) {
+        T* p = (*it).Detach();
+        std::size_t run = 1;
+        for (++it; it != last && (*it).Get() == p; ++it, ++run)
+          static_cast<void>((*it).Detach());
+        if (p != 0) {
+          detail::DropReferences(p, run);
+          ++runs;
+        }
+      }
+      return runs;
+    }
+    if (size < min_parallel_size || workers < 2) {
+      std::vector<T*> pointers;
+      pointers.reserve(size);
+      for (Iterator it = first; it != last; ++it) {
+        if (T* p = (*it).Detach())
+          pointers.push_back(p);
+      }
+      return detail::DropReferences(pointers, sort);
+    }
+
+    // First pass: every chunk detaches its references into one vector per
+    // bucket. Second pass: every bucket gathers its parts from all chunks
+    // and drops them; a pointee always maps to the same bucket, and the
+    // parts keep the order of the range.
+    std::size_t const chunks = workers * 2;
+    std::size_t const buckets = workers * 2;
+    std::size_t const chunk_size = (size + chunks - 1) / chunks;
+    std::vector<std::vector<T*>> parts(chunks * buckets);
+    executor.ForEach(chunks, [&](std::size_t chunk) {
+      std::size_t begin = std::min(size, chunk * chunk_size);
+      std::size_t end = std::min(size, begin + chunk_size);
+      std::vector<T*>* chunk_parts = &parts[chunk * buckets];
+      for (std::size_t i = begin; i < end; ++i) {
+        if (T* p = first[static_cast<typename std::iterator_traits<Iterator>::difference_type>(i)].Detach())
+          chunk_parts[detail::PointerBucket(p, buckets)].push_back(p);
+      }
+    });
+
+    std::atomic<std::size_t> decrements{ 0 };
+    executor.ForEach(buckets, [&](std::size_t bucket) {
+      std::size_t total = 0;
+      for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        total += parts[chunk * buckets + bucket].size();
+      std::vector<T*> pointers;
+      pointers.reserve(total);
+      for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+        std::vector<T*>& part = parts[chunk * buckets + bucket];
+        pointers.insert(pointers.end(), part.begin(), part.end());
+        std::vector<T*>().swap(part);
+      }
+      decrements.fetch_add(detail::DropReferences(pointers, sort), std::memory_order_relaxed);
+    });
+    return decrements.load(std::memory_order_relaxed);
+  }
+
+  template<class Range, class Executor>
+  std::size_t ParallelRelease(Range& range, Executor const& executor, ReleaseGrouping grouping = ReleaseGrouping::Adjacent, std::size_t min_parallel_size = 1u << 14)
+  {
+    using std::begin;
+    using std::end;
+    return ParallelRelease(begin(range), end(range), executor, grouping, min_parallel_size);
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_PARALLEL_H_
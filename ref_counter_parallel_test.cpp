@@ -0,0 +1,96 @@
+#include "catch.hpp"
+#include "ref_counter_parallel.h"
+#include "ref_counter_test_fixtures.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ref_counter::ParallelRelease;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadExecutor;
+using ref_counter::ThreadSafeCounter;
+
+namespace
+{
+  typedef ref_counter_test::CountingCounter<ThreadSafeCounter> CountingCounter;
+  typedef ref_counter_test::Payload<CountingCounter> Released;
+
+  // shared objects referenced copies times each, plus unique ones, shuffled.
+  std::vector<RefCounterPtr<Released>> MakeReferences(int shared, int copies, int unique)
+  {
+    std::vector<RefCounterPtr<Released>> references;
+    for (int i = 0; i < shared; ++i) {
+      RefCounterPtr<Released> object(new Released);
+      references.insert(references.end(), copies, object);
+    }
+    for (int i = 0; i < unique; ++i)
+      references.push_back(RefCounterPtr<Released>(new Released));
+    references.push_back(RefCounterPtr<Released>());
+    std::shuffle(references.begin(), references.end(), std::mt19937(42));
+    return references;
+  }
+}
+
+TEST_CASE("Test ParallelRelease") {
+  using ref_counter::ReleaseGrouping;
+
+  for (unsigned int threads : { 1u, 4u }) {
+    std::vector<RefCounterPtr<Released>> references = MakeReferences(100, 100, 10000);
+    RefCounterPtr<Released> kept = references[0] ? references[0] : references[1];
+
+    int before = CountingCounter::decrements;
+    std::size_t decrements = ParallelRelease(references, ThreadExecutor(threads), ReleaseGrouping::All, 0);
+
+    // One decrement per object, however often the range referenced it.
+    CHECK(decrements == 100 + 10000);
+    CHECK(CountingCounter::decrements - before == 100 + 10000);
+    CHECK(std::all_of(references.begin(), references.end(), [](RefCounterPtr<Released> const& p) { return !p; }));
+    CHECK(kept->UseCount() == 1);
+    CHECK(Released::alive == 1);
+    kept.Reset();
+    CHECK(Released::alive == 0);
+  }
+}
+
+TEST_CASE("Test ParallelRelease Adjacent Grouping") {
+  // Runs stay runs when the range is split between threads.
+  std::vector<RefCounterPtr<Released>> references;
+  for (int i = 0; i < 1000; ++i) {
+    RefCounterPtr<Released> object(new Released);
+    references.insert(references.end(), 10, object);
+  }
+  int before = CountingCounter::decrements;
+  std::size_t decrements = ParallelRelease(references, ThreadExecutor(4), ref_counter::ReleaseGrouping::Adjacent, 0);
+  CHECK(decrements >= 1000);
+  CHECK(decrements <= 1000 + 8);
+  CHECK(CountingCounter::decrements - before == static_cast<int>(decrements));
+  CHECK(Released::alive == 0);
+}
+
+TEST_CASE("Test ParallelRelease Small Range") {
+  std::vector<RefCounterPtr<Released>> references = MakeReferences(10, 3, 10);
+  CHECK(ParallelRelease(references.begin(), references.end(), ThreadExecutor(4)) <= 40);
+  CHECK(Released::alive == 0);
+
+  std::vector<RefCounterPtr<Released>> empty;
+  CHECK(ParallelRelease(empty, ThreadExecutor(4)) == 0);
+}
+
+TEST_CASE("Test ThreadExecutor Exception") {
+  // A task that throws on the calling thread leaves ForEach only after the
+  // helpers have finished.
+  std::thread::id caller = std::this_thread::get_id();
+  std::atomic<int> running{ 0 };
+  CHECK_THROWS_AS(ThreadExecutor(4).ForEach(100, [&](std::size_t) {
+    if (std::this_thread::get_id() == caller)
+      throw std::runtime_error("task failed");
+    ++running;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    --running;
+  }), std::runtime_error);
+  CHECK(running == 0);
+}
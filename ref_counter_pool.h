@@ -0,0 +1,188 @@
+#ifndef REF_COUNTER_POOL_H_
+#define REF_COUNTER_POOL_H_
+
+#include "ref_counter.h"
+#include <cstddef>
+#include <new>
+
+namespace ref_counter
+{
+  // Thread-local, size-class segregated free lists. Memory released on a
+  // thread is cached by that thread, up to a per-thread byte limit; anything
+  // beyond the limit, and any block larger than kMaxBlockSize, goes back to
+  // the global allocator.
+  class RefCounterPool
+  {
+  public:
+    static constexpr std::size_t kGranularity = alignof(std::max_align_t);
+    static constexpr std::size_t kMaxBlockSize = 512;
+    static constexpr std::size_t kSizeClassCount = kMaxBlockSize / kGranularity;
+    static constexpr std::size_t kDefaultMaxCachedBytes = 256 * 1024;
+
+    static void* Allocate(std::size_t size) {
+      if (size > kMaxBlockSize || TornDown())
+        return ::operator new(size);
+      ThreadCache& cache = Cache();
+      std::size_t size_class = SizeClass(size);
+      FreeBlock* block = cache.free_lists[size_class];
+      if (block == nullptr)
+        return ::operator new(BlockSize(size_class));
+      cache.free_lists[size_class] = block->next;
+      cache.cached_bytes -= BlockSize(size_class);
+      return block;
+    }
+
+    static void Deallocate(void* p, std::size_t size) noexcept {
+      if (p == nullptr)
+        return;
+      if (size > kMaxBlockSize || TornDown()) {
+        ::operator delete(p);
+        return;
+      }
+      ThreadCache& cache = Cache();
+      std::size_t size_class = SizeClass(size);
+      if (cache.cached_bytes + BlockSize(size_class) > cache.max_cached_bytes) {
+        ::operator delete(p);
+        return;
+      }
+      FreeBlock* block = static_cast<FreeBlock*>(p);
+      block->next = cache.free_lists[size_class];
+      cache.free_lists[size_class] = block;
+      cache.cached_bytes += BlockSize(size_class);
+    }
+
+    // Pre-warms the calling thread's cache with count blocks able to hold
+    // size bytes, as far as the byte limit allows.
+    static void Reserve(std::size_t size, std::size_t count) {
+      if (size > kMaxBlockSize || TornDown())
+        return;
+      std::size_t block_size = BlockSize(SizeClass(size));
+      for (std::size_t i = 0; i < count; ++i) {
+        if (Cache().cached_bytes + block_size > Cache().max_cached_bytes)
+          break;
+        Deallocate(::operator new(block_size), size);
+      }
+    }
+
+    template<class T>
+    static void Reserve(std::size_t count) {
+      Reserve(sizeof(T), count);
+    }
+
+    // Caps the memory the calling thread keeps cached, releasing the excess.
+    static void SetMaxCachedBytes(std::size_t bytes) noexcept {
+      if (TornDown())
+        return;
+      ThreadCache& cache = Cache();
+      cache.max_cached_bytes = bytes;
+      for (std::size_t size_class = kSizeClassCount; size_class-- > 0 && cache.cached_bytes > bytes;) {
+        while (cache.free_lists[size_class] != nullptr && cache.cached_bytes > bytes)
+          ReleaseOne(cache, size_class);
+      }
+    }
+
+    static std::size_t MaxCachedBytes() noexcept {
+      return TornDown() ? 0 : Cache().max_cached_bytes;
+    }
+
+    static std::size_t CachedBytes() noexcept {
+      return TornDown() ? 0 : Cache().cached_bytes;
+    }
+
+    // Returns everything the calling thread has cached to the global allocator.
+    static void Trim() noexcept {
+      if (TornDown())
+        return;
+      ThreadCache& cache = Cache();
+      for (std::size_t size_class = 0; size_class < kSizeClassCount; ++size_class) {
+        while (cache.free_lists[size_class] != nullptr)
+          ReleaseOne(cache, size_class);
+      }
+    }
+
+  private:
+    struct FreeBlock
+    {
+      FreeBlock* next;
+    };
+
+    struct ThreadCache
+    {
+      FreeBlock* free_lists[kSizeClassCount] = {};
+      std::size_t cached_bytes = 0;
+      std::size_t max_cached_bytes = kDefaultMaxCachedBytes;
+
+      ~ThreadCache() {
+        Trim();
+        TornDown() = true;
+      }
+    };
+
+    static ThreadCache& Cache() noexcept {
+      static thread_local ThreadCache cache;
+      return cache;
+    }
+
+    // Set once the calling thread's cache is destroyed. Objects released
+    // later during thread exit then bypass it; the flag is trivially
+    // destructible, so reading it then is fine where touching the cache is
+    // not.
+    static bool& TornDown() noexcept {
+      static thread_local bool torn_down = false;
+      return torn_down;
+    }
+
+    static constexpr std::size_t SizeClass(std::size_t size) noexcept {
+      return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static constexpr std::size_t BlockSize(std::size_t size_class) noexcept {
+      return (size_class + 1) * kGranularity;
+    }
+
+    static void ReleaseOne(ThreadCache& cache, std::size_t size_class) noexcept {
+      FreeBlock* block = cache.free_lists[size_class];
+      cache.free_lists[size_class] = block->next;
+      cache.cached_bytes -= BlockSize(size_class);
+      ::operator delete(block);
+    }
+  };
+
+  // Mixin that routes the allocation of the most derived object through
+  // RefCounterPool. Base is RefCounter<Policy> or an interface deriving from
+  // it; OnFinalDestroy keeps its `delete this`, which resolves to the sized
+  // operator delete below through the virtual destructor.
+  template<class Base = RefCounter<>>
+  class PooledRefCounter
+    : public Base
+  {
+  public:
+    static void* operator new(std::size_t size) {
+      return RefCounterPool::Allocate(size);
+    }
+
+    static void operator delete(void* p, std::size_t size) noexcept {
+      RefCounterPool::Deallocate(p, size);
+    }
+
+    // Pool blocks are only aligned for max_align_t; over-aligned types, such
+    // as those using CacheAlignedCounter, go to the global allocator.
+    static void* operator new(std::size_t size, std::align_val_t alignment) {
+      return ::operator new(size, alignment);
+    }
+
+    static void operator delete(void* p, std::size_t size, std::align_val_t alignment) noexcept {
+      ::operator delete(p, size, alignment);
+    }
+
+  protected:
+    using Base::Base;
+
+    PooledRefCounter() = default;
+
+    virtual ~PooledRefCounter() = default;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_POOL_H_
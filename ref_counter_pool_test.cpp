@@ -0,0 +1,150 @@
+#include "catch.hpp"
+#include "ref_counter_pool.h"
+#include <cstdint>
+#include <string>
+#include <thread>
+
+using ref_counter::CacheAlignedCounter;
+using ref_counter::kCacheLineSize;
+using ref_counter::MakeRef;
+using ref_counter::PooledRefCounter;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPool;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter;
+
+class PooledMessage
+  : public PooledRefCounter<RefCounter<ThreadUnsafeCounter>>
+{
+public:
+  PooledMessage(int id, std::string body)
+    : id_(id)
+    , body_(body)
+  {
+
+  }
+
+  int Id() const { return id_; }
+
+  std::string const& Body() const { return body_; }
+
+protected:
+  virtual ~PooledMessage() = default;
+
+private:
+  int id_;
+  std::string body_;
+};
+
+class PooledInterface
+  : virtual public RefCounter<ThreadSafeCounter>
+{
+public:
+  virtual int Value() = 0;
+
+protected:
+  virtual ~PooledInterface() = default;
+};
+
+class PooledImplementation
+  : public PooledRefCounter<PooledInterface>
+{
+public:
+  PooledImplementation(int v) : value(v)
+  {
+
+  }
+
+  virtual int Value() override {
+    return value;
+  }
+
+protected:
+  virtual ~PooledImplementation() = default;
+
+private:
+  int value;
+};
+
+class PooledAligned
+  : public PooledRefCounter<RefCounter<CacheAlignedCounter>>
+{
+protected:
+  virtual ~PooledAligned() = default;
+};
+
+TEST_CASE("Test MakeRef") {
+  RefCounterPtr<PooledMessage> message = MakeRef<PooledMessage>(3, "three");
+  CHECK(message->UseCount() == 1);
+  CHECK(message->Id() == 3);
+  CHECK(message->Body() == "three");
+}
+
+TEST_CASE("Test Pooled Allocation Reuse") {
+  RefCounterPool::Trim();
+  CHECK(RefCounterPool::CachedBytes() == 0);
+  RefCounterPtr<PooledMessage> message = MakeRef<PooledMessage>(1, "one");
+  void* address = message.Get();
+  message.Reset();
+  CHECK(RefCounterPool::CachedBytes() >= sizeof(PooledMessage));
+  message = MakeRef<PooledMessage>(2, "two");
+  CHECK(static_cast<void*>(message.Get()) == address);
+  CHECK(RefCounterPool::CachedBytes() == 0);
+  RefCounterPtr<PooledInterface> object = MakeRef<PooledImplementation>(5);
+  CHECK(object->Value() == 5);
+  object.Reset();
+  CHECK(RefCounterPool::CachedBytes() >= sizeof(PooledImplementation));
+  RefCounterPool::Trim();
+  CHECK(RefCounterPool::CachedBytes() == 0);
+}
+
+TEST_CASE("Test Pool Reserve And Limit") {
+  std::size_t limit = RefCounterPool::MaxCachedBytes();
+  RefCounterPool::Trim();
+  RefCounterPool::Reserve<PooledMessage>(8);
+  CHECK(RefCounterPool::CachedBytes() >= 8 * sizeof(PooledMessage));
+  RefCounterPool::SetMaxCachedBytes(sizeof(PooledMessage));
+  CHECK(RefCounterPool::CachedBytes() <= sizeof(PooledMessage));
+  RefCounterPool::SetMaxCachedBytes(0);
+  CHECK(RefCounterPool::CachedBytes() == 0);
+  RefCounterPtr<PooledMessage> message = MakeRef<PooledMessage>(1, "one");
+  message.Reset();
+  CHECK(RefCounterPool::CachedBytes() == 0);
+  RefCounterPool::SetMaxCachedBytes(limit);
+}
+
+TEST_CASE("Test Pool Cross Thread Release") {
+  RefCounterPool::Trim();
+  RefCounterPtr<PooledMessage> message = MakeRef<PooledMessage>(4, "four");
+  std::thread([&] {
+    message.Reset();
+  }).join();
+  CHECK(!message);
+  CHECK(RefCounterPool::CachedBytes() == 0);
+}
+
+TEST_CASE("Test Pool Release After Thread Cache Teardown") {
+  std::size_t cached_at_exit = 1;
+  std::thread([&] {
+    // Thread-local objects are destroyed in reverse order of construction:
+    // the cache first, then the message released into it, then the probe.
+    struct Probe
+    {
+      std::size_t& cached;
+      ~Probe() { cached = RefCounterPool::CachedBytes(); }
+    };
+    static thread_local Probe probe{ cached_at_exit };
+    static thread_local RefCounterPtr<PooledMessage> late;
+    late = MakeRef<PooledMessage>(5, "five");
+  }).join();
+  CHECK(cached_at_exit == 0);
+}
+
+TEST_CASE("Test Pool Over-Aligned Type") {
+  RefCounterPool::Trim();
+  RefCounterPtr<PooledAligned> aligned = MakeRef<PooledAligned>();
+  CHECK(reinterpret_cast<std::uintptr_t>(aligned.Get()) % kCacheLineSize == 0);
+  aligned.Reset();
+  CHECK(RefCounterPool::CachedBytes() == 0);
+}
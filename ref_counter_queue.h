@@ -0,0 +1,111 @@
+#ifndef REF_COUNTER_QUEUE_H_
+#define REF_COUNTER_QUEUE_H_
+
+#include "ref_counter.h"
+#include <atomic>
+
+namespace ref_counter
+{
+  template<class T> class RefCounterQueue;
+
+  // Link used by RefCounterQueue, derive from it next to the RefCounter base
+  // of types that are passed between threads. While queued the object is
+  // owned by the queue through the reference the producer gave up, so one
+  // object can only be in one queue, once, at a time.
+  class RefCounterQueueHook
+  {
+  protected:
+    RefCounterQueueHook() noexcept = default;
+    RefCounterQueueHook(RefCounterQueueHook const&) noexcept
+    {
+    }
+
+    RefCounterQueueHook& operator= (RefCounterQueueHook const&) noexcept { return *this; }
+    ~RefCounterQueueHook() = default;
+
+  private:
+    template<class T> friend class RefCounterQueue;
+
+    std::atomic<RefCounterQueueHook*> m_queue_next{ nullptr };
+  };
+
+  // Lock-free intrusive multi-producer single-consumer queue (Vyukov). Push
+  // keeps the reference it is given and Pop hands it back, so passing an
+  // object through the queue touches neither its count nor the allocator.
+  // Push is wait-free; Pop is for one consumer thread at a time and may
+  // return null while a push is halfway done.
+  template<class T>
+  class RefCounterQueue
+  {
+  public:
+    RefCounterQueue() noexcept
+      : m_head(&m_stub)
+      , m_tail(&m_stub)
+    {
+    }
+
+    RefCounterQueue(RefCounterQueue const&) = delete;
+    RefCounterQueue& operator= (RefCounterQueue const&) = delete;
+
+    ~RefCounterQueue() {
+      while (Pop()) {}
+    }
+
+    // Pass a moved pointer to hand over the caller's reference, a copy costs
+    // one increment.
+    void Push(RefCounterPtr<T> p) noexcept
+    {
+      if (p)
+        PushHook(static_cast<RefCounterQueueHook*>(p.Detach()));
+    }
+
+    RefCounterPtr<T> Pop() noexcept
+    {
+      RefCounterQueueHook* tail = m_tail;
+      RefCounterQueueHook* next = tail->m_queue_next.load(std::memory_order_acquire);
+      if (tail == &m_stub) {
+        if (next == nullptr)
+          return RefCounterPtr<T>();
+        m_tail = next;
+        tail = next;
+        next = next->m_queue_next.load(std::memory_order_acquire);
+      }
+      if (next == nullptr) {
+        if (tail != m_head.load(std::memory_order_acquire))
+          return RefCounterPtr<T>();
+        PushHook(&m_stub);
+        next = tail->m_queue_next.load(std::memory_order_acquire);
+        if (next == nullptr)
+          return RefCounterPtr<T>();
+      }
+      m_tail = next;
+      return RefCounterPtr<T>(static_cast<T*>(tail), false);
+    }
+
+    // Only meaningful on the consumer thread.
+    bool Empty() const noexcept
+    {
+      return m_tail == &m_stub && m_stub.m_queue_next.load(std::memory_order_acquire) == nullptr;
+    }
+
+  private:
+    class Stub
+      : public RefCounterQueueHook
+    {
+    };
+
+    void PushHook(RefCounterQueueHook* hook) noexcept
+    {
+      hook->m_queue_next.store(nullptr, std::memory_order_relaxed);
+      RefCounterQueueHook* previous = m_head.exchange(hook, std::memory_order_acq_rel);
+      previous->m_queue_next.store(hook, std::memory_order_release);
+    }
+
+    Stub m_stub;
+    alignas(kCacheLineSize) std::atomic<RefCounterQueueHook*> m_head;
+    alignas(kCacheLineSize) RefCounterQueueHook* m_tail;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_QUEUE_H_
@@ -0,0 +1,104 @@
+#include "catch.hpp"
+#include "ref_counter_queue.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterQueue;
+using ref_counter::RefCounterQueueHook;
+
+class Message
+  : public RefCounter<>
+  , public RefCounterQueueHook
+{
+public:
+  static std::atomic<int> alive;
+
+  explicit Message(int value)
+    : value(value)
+  {
+    ++alive;
+  }
+
+  int value;
+
+protected:
+  virtual ~Message() {
+    --alive;
+  }
+};
+
+std::atomic<int> Message::alive(0);
+
+TEST_CASE("Test RefCounterQueue") {
+  RefCounterQueue<Message> queue;
+  CHECK(queue.Empty());
+  CHECK(!queue.Pop());
+
+  RefCounterPtr<Message> first(new Message(1));
+  Message* raw = first.Get();
+  queue.Push(std::move(first));
+  CHECK(!first);
+  CHECK(raw->UseCount() == 1);
+  queue.Push(RefCounterPtr<Message>(new Message(2)));
+  CHECK(!queue.Empty());
+
+  RefCounterPtr<Message> popped = queue.Pop();
+  CHECK(popped.Get() == raw);
+  CHECK(popped->UseCount() == 1);
+  CHECK(queue.Pop()->value == 2);
+  CHECK(queue.Empty());
+  CHECK(!queue.Pop());
+
+  // The hook is free again once popped.
+  queue.Push(popped);
+  CHECK(raw->UseCount() == 2);
+  CHECK(queue.Pop() == popped);
+
+  popped.Reset();
+  CHECK(Message::alive == 0);
+}
+
+TEST_CASE("Test RefCounterQueue Releases Queued Objects") {
+  {
+    RefCounterQueue<Message> queue;
+    for (int i = 0; i < 3; ++i)
+      queue.Push(RefCounterPtr<Message>(new Message(i)));
+    CHECK(Message::alive == 3);
+  }
+  CHECK(Message::alive == 0);
+}
+
+TEST_CASE("Test RefCounterQueue Producers") {
+  constexpr int kProducers = 4;
+  constexpr int kMessages = 2000;
+  RefCounterQueue<Message> queue;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p] {
+      for (int i = 0; i < kMessages; ++i)
+        queue.Push(RefCounterPtr<Message>(new Message(p * kMessages + i)));
+    });
+  }
+
+  // Each producer's messages arrive in order.
+  std::vector<int> last(kProducers, -1);
+  int received = 0;
+  while (received < kProducers * kMessages) {
+    RefCounterPtr<Message> message = queue.Pop();
+    if (!message) {
+      std::this_thread::yield();
+      continue;
+    }
+    int producer = message->value / kMessages;
+    CHECK(message->value % kMessages > last[producer]);
+    last[producer] = message->value % kMessages;
+    ++received;
+  }
+  for (std::thread& producer : producers)
+    producer.join();
+  CHECK(queue.Empty());
+  CHECK(Message::alive == 0);
+}
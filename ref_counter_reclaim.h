@@ -0,0 +1,233 @@
+#ifndef REF_COUNTER_RECLAIM_H_
+#define REF_COUNTER_RECLAIM_H_
+
+#include "ref_counter.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ref_counter
+{
+  struct DeferredRelease
+  {
+    void* object;
+    void (*final_release)(void*);
+
+    void Run() const {
+      final_release(object);
+    }
+  };
+
+  struct DeferredReleaseStats
+  {
+    std::size_t depth = 0;
+    std::size_t deferred = 0;
+    std::size_t released = 0;
+    std::size_t drains = 0;
+    std::chrono::nanoseconds last_drain{ 0 };
+    std::chrono::nanoseconds max_drain{ 0 };
+    std::chrono::nanoseconds total_drain{ 0 };
+  };
+
+  // Installs sink on the calling thread for the lifetime of the scope.
+  // Scopes nest; the previous sink is restored on exit. Objects queued in
+  // the sink are not released by leaving the scope.
+  class DeferredReleaseScope
+  {
+  public:
+    explicit DeferredReleaseScope(DeferredReleaseSink& sink) noexcept
+      : m_previous(detail::CurrentDeferredReleaseSink())
+    {
+      detail::CurrentDeferredReleaseSink() = &sink;
+    }
+
+    DeferredReleaseScope(DeferredReleaseScope const&) = delete;
+    DeferredReleaseScope& operator= (DeferredReleaseScope const&) = delete;
+
+    ~DeferredReleaseScope() {
+      detail::CurrentDeferredReleaseSink() = m_previous;
+    }
+
+  private:
+    DeferredReleaseSink* m_previous;
+  };
+
+  // Single-threaded queue of final releases, drained where the application
+  // chooses. Releases made while draining on a thread that has the queue
+  // installed are appended and handled by the same Drain call, so deep
+  // object graphs are torn down iteratively.
+  class DeferredReleaseQueue
+    : public DeferredReleaseSink
+  {
+  public:
+    DeferredReleaseQueue() = default;
+
+    DeferredReleaseQueue(DeferredReleaseQueue const&) = delete;
+    DeferredReleaseQueue& operator= (DeferredReleaseQueue const&) = delete;
+
+    ~DeferredReleaseQueue() {
+      DeferredReleaseScope scope(*this);
+      Drain();
+    }
+
+    virtual void Defer(void* object, void (*final_release)(void*)) override {
+      m_pending.push_back(DeferredRelease{ object, final_release });
+      ++m_stats.deferred;
+    }
+
+    // Runs up to max_releases final releases and returns how many ran.
+    std::size_t Drain(std::size_t max_releases = std::numeric_limits<std::size_t>::max()) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::size_t released = 0;
+      while (released < max_releases && m_next < m_pending.size()) {
+        DeferredRelease release = m_pending[m_next++];
+        release.Run();
+        ++released;
+      }
+      if (m_next == m_pending.size()) {
+        m_pending.clear();
+        m_next = 0;
+      }
+      RecordDrain(released, std::chrono::steady_clock::now() - start);
+      return released;
+    }
+
+    std::size_t Depth() const noexcept {
+      return m_pending.size() - m_next;
+    }
+
+    DeferredReleaseStats Stats() const {
+      DeferredReleaseStats stats = m_stats;
+      stats.depth = Depth();
+      return stats;
+    }
+
+  private:
+    void RecordDrain(std::size_t released, std::chrono::nanoseconds elapsed) noexcept {
+      m_stats.released += released;
+      ++m_stats.drains;
+      m_stats.last_drain = elapsed;
+      m_stats.total_drain += elapsed;
+      if (elapsed > m_stats.max_drain)
+        m_stats.max_drain = elapsed;
+    }
+
+    std::vector<DeferredRelease> m_pending;
+    std::size_t m_next = 0;
+    DeferredReleaseStats m_stats;
+  };
+
+  // Sink that can be installed on any number of threads and runs the final
+  // releases on its own thread, in batches of up to batch_size, at the
+  // latest max_delay after they were queued.
+  class BackgroundReclaimer
+    : public DeferredReleaseSink
+  {
+  public:
+    explicit BackgroundReclaimer(std::size_t batch_size = 256, std::chrono::milliseconds max_delay = std::chrono::milliseconds(10))
+      : m_batch_size(batch_size)
+      , m_max_delay(max_delay)
+      , m_thread(&BackgroundReclaimer::Run, this)
+    {
+
+    }
+
+    BackgroundReclaimer(BackgroundReclaimer const&) = delete;
+    BackgroundReclaimer& operator= (BackgroundReclaimer const&) = delete;
+
+    ~BackgroundReclaimer() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+      }
+      m_wake.notify_one();
+      m_thread.join();
+    }
+
+    virtual void Defer(void* object, void (*final_release)(void*)) override {
+      bool wake;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(DeferredRelease{ object, final_release });
+        ++m_stats.deferred;
+        wake = m_pending.size() >= m_batch_size;
+      }
+      if (wake)
+        m_wake.notify_one();
+    }
+
+    // Blocks until the queue is empty, including the releases queued by the
+    // destructors it runs. Other threads must not keep queueing meanwhile.
+    void Flush() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_flush_requested = true;
+      m_wake.notify_one();
+      m_flushed.wait(lock, [&] { return m_stats.released == m_stats.deferred; });
+    }
+
+    std::size_t Depth() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_stats.deferred - m_stats.released;
+    }
+
+    DeferredReleaseStats Stats() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      DeferredReleaseStats stats = m_stats;
+      stats.depth = m_stats.deferred - m_stats.released;
+      return stats;
+    }
+
+  private:
+    void Run() {
+      // Releases made by the destructors running here are queued as well.
+      DeferredReleaseScope scope(*this);
+      std::vector<DeferredRelease> batch;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      for (;;) {
+        m_wake.wait_for(lock, m_max_delay, [&] {
+          return m_stopping || m_flush_requested || m_pending.size() >= m_batch_size;
+        });
+        if (m_pending.empty()) {
+          m_flush_requested = false;
+          m_flushed.notify_all();
+          if (m_stopping)
+            return;
+          continue;
+        }
+        batch.swap(m_pending);
+        lock.unlock();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (DeferredRelease const& release : batch)
+          release.Run();
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        lock.lock();
+        m_stats.released += batch.size();
+        ++m_stats.drains;
+        m_stats.last_drain = elapsed;
+        m_stats.total_drain += elapsed;
+        if (elapsed > m_stats.max_drain)
+          m_stats.max_drain = elapsed;
+        batch.clear();
+        m_flushed.notify_all();
+      }
+    }
+
+    std::size_t const m_batch_size;
+    std::chrono::milliseconds const m_max_delay;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    std::vector<DeferredRelease> m_pending;
+    DeferredReleaseStats m_stats;
+    bool m_stopping = false;
+    bool m_flush_requested = false;
+    std::thread m_thread;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_RECLAIM_H_
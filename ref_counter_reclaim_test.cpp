@@ -0,0 +1,84 @@
+#include "catch.hpp"
+#include "ref_counter_reclaim.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::BackgroundReclaimer;
+using ref_counter::DeferredReleaseQueue;
+using ref_counter::DeferredReleaseScope;
+using ref_counter::DeferredReleaseStats;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::ThreadSafeCounter;
+
+class ReclaimedNode
+  : public RefCounter<ThreadSafeCounter>
+{
+public:
+  static std::atomic<int> alive;
+  static std::atomic<std::thread::id> last_destroyed_on;
+
+  ReclaimedNode(RefCounterPtr<ReclaimedNode> next = RefCounterPtr<ReclaimedNode>())
+    : next_(next)
+  {
+    ++alive;
+  }
+
+protected:
+  virtual ~ReclaimedNode() {
+    last_destroyed_on = std::this_thread::get_id();
+    --alive;
+  }
+
+private:
+  RefCounterPtr<ReclaimedNode> next_;
+};
+
+std::atomic<int> ReclaimedNode::alive(0);
+std::atomic<std::thread::id> ReclaimedNode::last_destroyed_on;
+
+TEST_CASE("Test Deferred Release Queue") {
+  DeferredReleaseQueue queue;
+  RefCounterPtr<ReclaimedNode> head;
+  for (int i = 0; i < 3; ++i)
+    head = new ReclaimedNode(head);
+  {
+    DeferredReleaseScope scope(queue);
+    head.Reset();
+    CHECK(ReclaimedNode::alive == 3);
+    CHECK(queue.Depth() == 1);
+    CHECK(queue.Drain(1) == 1);
+    CHECK(ReclaimedNode::alive == 2);
+    CHECK(queue.Depth() == 1);
+    CHECK(queue.Drain() == 2);
+  }
+  CHECK(ReclaimedNode::alive == 0);
+  CHECK(queue.Depth() == 0);
+  DeferredReleaseStats stats = queue.Stats();
+  CHECK(stats.deferred == 3);
+  CHECK(stats.released == 3);
+  CHECK(stats.drains == 2);
+  CHECK(stats.max_drain >= stats.last_drain);
+  head = new ReclaimedNode;
+  head.Reset();
+  CHECK(ReclaimedNode::alive == 0);
+}
+
+TEST_CASE("Test Background Reclaimer") {
+  BackgroundReclaimer reclaimer(4);
+  std::vector<RefCounterPtr<ReclaimedNode>> nodes;
+  for (int i = 0; i < 10; ++i)
+    nodes.push_back(new ReclaimedNode(i % 2 ? nodes.back() : RefCounterPtr<ReclaimedNode>()));
+  {
+    DeferredReleaseScope scope(reclaimer);
+    nodes.clear();
+  }
+  reclaimer.Flush();
+  CHECK(ReclaimedNode::alive == 0);
+  CHECK(ReclaimedNode::last_destroyed_on.load() != std::this_thread::get_id());
+  DeferredReleaseStats stats = reclaimer.Stats();
+  CHECK(stats.deferred == 10);
+  CHECK(stats.released == 10);
+  CHECK(stats.depth == 0);
+}
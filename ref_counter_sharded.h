@@ -0,0 +1,142 @@
+#ifndef REF_COUNTER_SHARDED_H_
+#define REF_COUNTER_SHARDED_H_
+
+#include "ref_counter.h"
+#include <atomic>
+#include <cstddef>
+#include <limits>
+
+namespace ref_counter
+{
+  // Counter policy for a few objects that every thread copies all the time.
+  // Each thread counts in one of ShardCount cache-line sized shards picked
+  // by thread, so copies on different threads do not contend. While sharded
+  // the count can not reach zero: a bias in the central count keeps the
+  // object alive and Decrement returns a non-zero placeholder. Kill (e.g.
+  // RefCounter::Kill) folds the shards into the central count once, after
+  // which every operation uses it and the last Decrement destroys the
+  // object, as with percpu_ref. Kill must be called while holding a
+  // reference; without it the object is never destroyed.
+  template<std::size_t ShardCount>
+  struct BasicShardedCounter
+  {
+    typedef unsigned int ValueType;
+
+    class Type
+    {
+    public:
+      Type(unsigned int initial) noexcept
+        : m_central(kBias + initial)
+        , m_dead(false)
+      {
+      }
+
+      Type(Type const&) = delete;
+      Type& operator= (Type const&) = delete;
+
+    private:
+      friend struct BasicShardedCounter;
+
+      struct alignas(kCacheLineSize) Shard
+      {
+        std::atomic<long long> count{ 0 };
+      };
+
+      Shard m_shards[ShardCount];
+      alignas(kCacheLineSize) std::atomic<long long> m_central;
+      std::atomic<bool> m_dead;
+    };
+
+    static unsigned int Load(Type const& counter) noexcept
+    {
+      long long count = counter.m_central.load(std::memory_order_acquire);
+      if (!counter.m_dead.load(std::memory_order_acquire)) {
+        count -= kBias;
+        for (typename Type::Shard const& shard : counter.m_shards)
+          count += shard.count.load(std::memory_order_relaxed);
+      }
+      return Clamp(count);
+    }
+
+    // The sum of the shards is only a snapshot, so the count is known to be
+    // one only after Kill.
+    static bool IsUnique(Type const& counter) noexcept
+    {
+      return counter.m_dead.load(std::memory_order_acquire) && counter.m_central.load(std::memory_order_acquire) == 1;
+    }
+
+    static void Increment(Type& counter) noexcept
+    {
+      if (CurrentShard(counter).fetch_add(1, std::memory_order_relaxed) >= kDeadThreshold)
+        counter.m_central.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static unsigned int Decrement(Type& counter) noexcept
+    {
+      if (CurrentShard(counter).fetch_sub(1, std::memory_order_release) < kDeadThreshold)
+        return 1;
+      long long result = counter.m_central.fetch_sub(1, detail::kReleaseDecrement) - 1;
+      if (result == 0)
+        detail::AcquireLastRelease();
+      return Clamp(result);
+    }
+
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      if (CurrentShard(counter).fetch_add(1, std::memory_order_relaxed) < kDeadThreshold)
+        return true;
+      long long current = counter.m_central.load(std::memory_order_relaxed);
+      do {
+        if (current == 0)
+          return false;
+      } while (!counter.m_central.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+      return true;
+    }
+
+    // Switches to counting in the central count. Operations that raced with
+    // the switch land either in a shard before it is collected or in the
+    // central count, never in both.
+    static void Kill(Type& counter) noexcept
+    {
+      if (counter.m_dead.exchange(true, std::memory_order_acq_rel))
+        return;
+      long long sum = 0;
+      for (typename Type::Shard& shard : counter.m_shards)
+        sum += shard.count.exchange(kDeadValue, std::memory_order_acq_rel);
+      counter.m_central.fetch_add(sum - kBias, std::memory_order_acq_rel);
+    }
+
+    static bool IsKilled(Type const& counter) noexcept
+    {
+      return counter.m_dead.load(std::memory_order_acquire);
+    }
+
+  private:
+    // Live shards stay far below kDeadThreshold, killed shards start at
+    // kDeadValue and drift by at most the operations still in flight.
+    static constexpr long long kBias = 1LL << 40;
+    static constexpr long long kDeadThreshold = 1LL << 62;
+    static constexpr long long kDeadValue = kDeadThreshold + (1LL << 61);
+
+    static std::atomic<long long>& CurrentShard(Type& counter) noexcept
+    {
+      static std::atomic<std::size_t> next_index{ 0 };
+      static thread_local std::size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+      return counter.m_shards[index].count;
+    }
+
+    static unsigned int Clamp(long long count) noexcept
+    {
+      if (count <= 0)
+        return 0;
+      if (count > static_cast<long long>(std::numeric_limits<unsigned int>::max()))
+        return std::numeric_limits<unsigned int>::max();
+      return static_cast<unsigned int>(count);
+    }
+  };
+
+  typedef BasicShardedCounter<32> ShardedCounter;
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_SHARDED_H_
@@ -0,0 +1,80 @@
+#include "catch.hpp"
+#include "ref_counter_sharded.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterWeakPtr;
+using ref_counter::ShardedCounter;
+using ref_counter::WeakRefCounter;
+
+class HotConfig
+  : public WeakRefCounter<ShardedCounter>
+{
+public:
+  static std::atomic<int> alive;
+
+  HotConfig()
+  {
+    ++alive;
+  }
+
+protected:
+  virtual ~HotConfig() {
+    --alive;
+  }
+};
+
+std::atomic<int> HotConfig::alive(0);
+
+TEST_CASE("Test Sharded Counter") {
+  RefCounterPtr<HotConfig> config(new HotConfig);
+  RefCounterWeakPtr<HotConfig> weak(config);
+  CHECK(config->UseCount() == 1);
+  {
+    RefCounterPtr<HotConfig> copy = config;
+    RefCounterPtr<HotConfig> other;
+    std::thread([&] { other = config; }).join();
+    CHECK(config->UseCount() == 3);
+  }
+  CHECK(config->UseCount() == 1);
+
+  // Still sharded: dropping every reference does not destroy the object.
+  HotConfig* raw = config.Detach();
+  raw->Decrement();
+  CHECK(HotConfig::alive == 1);
+  config.Reset(raw);
+  CHECK(weak.Lock() == config);
+
+  config->Kill();
+  CHECK(config->UseCount() == 1);
+  config.Reset();
+  CHECK(HotConfig::alive == 0);
+  CHECK(!weak.Lock());
+}
+
+TEST_CASE("Test Sharded Counter Kill Race") {
+  for (int round = 0; round < 20; ++round) {
+    RefCounterPtr<HotConfig> config(new HotConfig);
+    std::atomic<bool> start(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&start, copy = config]() mutable {
+        while (!start) {}
+        for (int j = 0; j < 2000; ++j) {
+          RefCounterPtr<HotConfig> another = copy;
+          copy = another;
+        }
+        copy.Reset();
+      });
+    }
+    start = true;
+    config->Kill();
+    config.Reset();
+    for (std::thread& thread : threads)
+      thread.join();
+    CHECK(HotConfig::alive == 0);
+  }
+}
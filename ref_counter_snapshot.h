@@ -0,0 +1,279 @@
+#ifndef REF_COUNTER_SNAPSHOT_H_
+#define REF_COUNTER_SNAPSHOT_H_
+
+#include "ref_counter.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+// Without NOMINMAX the min and max macros break std::numeric_limits<T>::max()
+// and std::min in every header included after this one.
+#ifndef NOMINMAX
+#define NOMINMAX
+#include <windows.h>
+#undef NOMINMAX
+#else
+#include <windows.h>
+#endif
+#elif defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Lets readers of a Snapshot skip the hardware fence on entry; writers then
+// make the other threads fence with membarrier() or
+// FlushProcessWriteBuffers(). Off under ThreadSanitizer, which does not
+// know about these.
+#ifndef REF_COUNTER_SNAPSHOT_ASYMMETRIC_FENCE
+#define REF_COUNTER_SNAPSHOT_ASYMMETRIC_FENCE (!REF_COUNTER_THREAD_SANITIZER)
+#endif
+
+namespace ref_counter
+{
+  namespace detail
+  {
+    // A full fence split in a cheap half for the frequent side and an
+    // expensive half for the rare one. Falls back to two hardware fences if
+    // the system can not do it.
+    class AsymmetricFence
+    {
+    public:
+      static void Light() noexcept {
+        if (Enabled())
+          std::atomic_signal_fence(std::memory_order_seq_cst);
+        else
+          Full();
+      }
+
+      static void Heavy() noexcept {
+#if REF_COUNTER_SNAPSHOT_ASYMMETRIC_FENCE
+        if (Enabled()) {
+#if defined(_WIN32)
+          FlushProcessWriteBuffers();
+#elif defined(__linux__)
+          syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+#endif
+          return;
+        }
+#endif
+        Full();
+      }
+
+    private:
+      // ThreadSanitizer does not model fences either. A read-modify-write of
+      // one shared word orders the two sides the same way: whichever comes
+      // second sees everything before the first.
+      static void Full() noexcept {
+#if REF_COUNTER_THREAD_SANITIZER
+        static std::atomic<int> word{ 0 };
+        word.fetch_add(0, std::memory_order_seq_cst);
+#else
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+      }
+
+      static bool Enabled() noexcept {
+        static bool const enabled = Register();
+        return enabled;
+      }
+
+      static bool Register() noexcept {
+#if REF_COUNTER_SNAPSHOT_ASYMMETRIC_FENCE && defined(_WIN32)
+        return true;
+#elif REF_COUNTER_SNAPSHOT_ASYMMETRIC_FENCE && defined(__linux__)
+        return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+        return false;
+#endif
+      }
+    };
+
+    // Read-side state of one thread: the epoch it entered in, 0 outside a
+    // read section. Recycled like HazardSlot.
+    struct alignas(kCacheLineSize) ReaderSlot
+    {
+      std::atomic<std::uint64_t> epoch{ 0 };
+      unsigned depth = 0;
+      std::atomic<bool> in_use{ true };
+      ReaderSlot* next = nullptr;
+    };
+
+    class ReaderSlots
+    {
+    public:
+      static ReaderSlot& Enter() {
+        ReaderSlot& slot = Current();
+        if (slot.depth++ == 0) {
+          slot.epoch.store(Epoch().load(std::memory_order_acquire), std::memory_order_relaxed);
+          AsymmetricFence::Light();
+        }
+        return slot;
+      }
+
+      static void Exit(ReaderSlot& slot) noexcept {
+        if (--slot.depth == 0)
+          slot.epoch.store(0, std::memory_order_release);
+      }
+
+      // Waits until every read section that may have seen a value replaced
+      // before the call has ended.
+      static void Synchronize() {
+        assert(Current().depth == 0 && "Synchronize inside a read section never returns");
+        std::uint64_t target = Epoch().fetch_add(1, std::memory_order_acq_rel) + 1;
+        AsymmetricFence::Heavy();
+        for (ReaderSlot* slot = Head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+          for (;;) {
+            std::uint64_t epoch = slot->epoch.load(std::memory_order_acquire);
+            if (epoch == 0 || epoch >= target)
+              break;
+            std::this_thread::yield();
+          }
+        }
+      }
+
+    private:
+      struct Holder
+      {
+        ReaderSlot* slot = Acquire();
+
+        ~Holder() {
+          slot->in_use.store(false, std::memory_order_release);
+        }
+      };
+
+      static ReaderSlot& Current() {
+        static thread_local Holder holder;
+        return *holder.slot;
+      }
+
+      static std::atomic<std::uint64_t>& Epoch() noexcept {
+        static std::atomic<std::uint64_t> epoch{ 1 };
+        return epoch;
+      }
+
+      static std::atomic<ReaderSlot*>& Head() noexcept {
+        static std::atomic<ReaderSlot*> head{ nullptr };
+        return head;
+      }
+
+      static ReaderSlot* Acquire() {
+        for (ReaderSlot* slot = Head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+          if (!slot->in_use.load(std::memory_order_relaxed) && !slot->in_use.exchange(true, std::memory_order_acquire))
+            return slot;
+        }
+        ReaderSlot* slot = new ReaderSlot;
+        slot->next = Head().load(std::memory_order_relaxed);
+        while (!Head().compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+        return slot;
+      }
+    };
+  } // namespace detail
+
+  // Publishes read-mostly data, RCU style. Readers open a ReadGuard and use
+  // the current value without touching its count; entering and leaving is
+  // a few plain stores to a per-thread slot. Publish swaps in a new value,
+  // waits for the readers that may still see the old one and then drops the
+  // reference to it, so the last release goes through OnFinalDestroy as
+  // usual. Publishing is serialized and blocks for that grace period; it
+  // must not be called inside a read section of the same thread.
+  template<class T>
+  class Snapshot
+  {
+  public:
+    class ReadGuard
+    {
+    public:
+      explicit ReadGuard(Snapshot const& snapshot)
+        : m_slot(detail::ReaderSlots::Enter())
+        , m_value(snapshot.m_current.load(std::memory_order_acquire))
+      {
+      }
+
+      ReadGuard(ReadGuard const&) = delete;
+      ReadGuard& operator= (ReadGuard const&) = delete;
+
+      ~ReadGuard() {
+        detail::ReaderSlots::Exit(m_slot);
+      }
+
+      T const* Get() const noexcept
+      {
+        return m_value;
+      }
+
+      T const& operator*() const noexcept
+      {
+        assert(m_value != 0);
+        return *m_value;
+      }
+
+      T const* operator->() const noexcept
+      {
+        assert(m_value != 0);
+        return m_value;
+      }
+
+      explicit operator bool() const noexcept
+      {
+        return m_value != 0;
+      }
+
+      // A counted reference for use after the guard is gone.
+      RefCounterPtr<T> Acquire() const
+      {
+        return RefCounterPtr<T>(m_value);
+      }
+
+    private:
+      detail::ReaderSlot& m_slot;
+      T* m_value;
+    };
+
+    Snapshot() noexcept : m_current(nullptr)
+    {
+    }
+
+    explicit Snapshot(RefCounterPtr<T> initial) noexcept : m_current(initial.Detach())
+    {
+    }
+
+    Snapshot(Snapshot const&) = delete;
+    Snapshot& operator= (Snapshot const&) = delete;
+
+    // No reader may still be inside a read section of this snapshot.
+    ~Snapshot()
+    {
+      T* p = m_current.load(std::memory_order_relaxed);
+      if (p != 0) p->Decrement();
+    }
+
+    ReadGuard Read() const
+    {
+      return ReadGuard(*this);
+    }
+
+    RefCounterPtr<T> Load() const
+    {
+      return Read().Acquire();
+    }
+
+    void Publish(RefCounterPtr<T> next)
+    {
+      std::lock_guard<std::mutex> lock(m_writer);
+      T* previous = m_current.exchange(next.Detach(), std::memory_order_seq_cst);
+      detail::ReaderSlots::Synchronize();
+      if (previous != 0) previous->Decrement();
+    }
+
+  private:
+    std::atomic<T*> m_current;
+    std::mutex m_writer;
+  };
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_SNAPSHOT_H_
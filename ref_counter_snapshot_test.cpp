@@ -0,0 +1,118 @@
+#include "catch.hpp"
+#include "ref_counter_snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::Snapshot;
+
+namespace
+{
+  class Table
+    : public RefCounter<>
+  {
+  public:
+    static std::atomic<int> alive;
+
+    explicit Table(int version)
+      : version(version)
+      , checksum(~version)
+    {
+      ++alive;
+    }
+
+    ~Table()
+    {
+      checksum = 0;
+      --alive;
+    }
+
+    bool Valid() const noexcept
+    {
+      return checksum == ~version;
+    }
+
+    int version;
+    int checksum;
+  };
+
+  std::atomic<int> Table::alive{ 0 };
+}
+
+TEST_CASE("Test Snapshot") {
+  Table::alive = 0;
+  {
+    Snapshot<Table> snapshot;
+    CHECK(!snapshot.Read());
+    CHECK(!snapshot.Load());
+
+    snapshot.Publish(RefCounterPtr<Table>(new Table(1)));
+    {
+      auto guard = snapshot.Read();
+      REQUIRE(guard);
+      CHECK(guard->version == 1);
+      // Reading takes no reference.
+      CHECK(guard->UseCount() == 1);
+
+      // Sections nest.
+      auto inner = snapshot.Read();
+      CHECK(inner.Get() == guard.Get());
+    }
+
+    // A counted reference outlives the version it was taken from.
+    RefCounterPtr<Table> kept = snapshot.Load();
+    CHECK(kept->UseCount() == 2);
+    snapshot.Publish(RefCounterPtr<Table>(new Table(2)));
+    CHECK(Table::alive == 2);
+    CHECK(kept->version == 1);
+    kept.Reset();
+    CHECK(Table::alive == 1);
+
+    // Without other references the old version goes on publish.
+    snapshot.Publish(RefCounterPtr<Table>(new Table(3)));
+    CHECK(Table::alive == 1);
+    CHECK(snapshot.Read()->version == 3);
+  }
+  CHECK(Table::alive == 0);
+}
+
+TEST_CASE("Test Snapshot Concurrent") {
+  Table::alive = 0;
+  {
+    Snapshot<Table> snapshot(RefCounterPtr<Table>(new Table(0)));
+    std::atomic<bool> done{ false };
+    std::atomic<int> errors{ 0 };
+    unsigned reader_count = std::max(2u, std::thread::hardware_concurrency());
+
+    std::vector<std::thread> readers;
+    for (unsigned i = 0; i < reader_count; ++i) {
+      readers.emplace_back([&] {
+        int last = 0;
+        while (!done.load(std::memory_order_relaxed)) {
+          auto guard = snapshot.Read();
+          // A later section never sees an older version.
+          if (!guard->Valid() || guard->version < last)
+            ++errors;
+          last = guard->version;
+          std::this_thread::yield();
+          if (!guard->Valid())
+            ++errors;
+        }
+      });
+    }
+
+    for (int version = 1; version <= 1000; ++version)
+      snapshot.Publish(RefCounterPtr<Table>(new Table(version)));
+    done = true;
+    for (auto& reader : readers)
+      reader.join();
+
+    CHECK(errors == 0);
+    CHECK(Table::alive == 1);
+    CHECK(snapshot.Read()->version == 1000);
+  }
+  CHECK(Table::alive == 0);
+}
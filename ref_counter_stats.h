@@ -0,0 +1,320 @@
+#ifndef REF_COUNTER_STATS_H_
+#define REF_COUNTER_STATS_H_
+
+#include "ref_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+// Enables OptionalInstrumentedCounter. Off by default, in which case it is
+// the plain policy and nothing is recorded.
+#ifndef REF_COUNTER_STATS
+#define REF_COUNTER_STATS 0
+#endif
+
+namespace ref_counter
+{
+  struct RefCountStatistics
+  {
+    char const* name = nullptr;
+    std::uint64_t increments = 0;
+    std::uint64_t decrements = 0;
+    std::uint64_t final_releases = 0;
+    std::uint64_t try_increments = 0;
+    std::uint64_t failed_try_increments = 0;
+    std::uint64_t peak_use_count = 0;
+  };
+
+  namespace detail
+  {
+    // Counters of one thread for one instrumented policy. Only the owning
+    // thread writes them, so updates are plain relaxed load/store pairs. A
+    // shared block, such as the orphan block written by threads in
+    // thread-local teardown, uses read-modify-writes instead.
+    struct RefCountStatsBlock
+    {
+      explicit RefCountStatsBlock(bool shared = false) noexcept
+        : shared(shared)
+      {
+      }
+
+      std::atomic<std::uint64_t> increments{ 0 };
+      std::atomic<std::uint64_t> decrements{ 0 };
+      std::atomic<std::uint64_t> final_releases{ 0 };
+      std::atomic<std::uint64_t> try_increments{ 0 };
+      std::atomic<std::uint64_t> failed_try_increments{ 0 };
+      std::atomic<std::uint64_t> peak_use_count{ 0 };
+      RefCountStatsBlock* next = nullptr;
+      bool const shared;
+
+      void Bump(std::atomic<std::uint64_t>& value) noexcept {
+        if (shared)
+          value.fetch_add(1, std::memory_order_relaxed);
+        else
+          value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+
+      void RecordUseCount(std::uint64_t use_count) noexcept {
+        std::uint64_t peak = peak_use_count.load(std::memory_order_relaxed);
+        if (!shared) {
+          if (use_count > peak)
+            peak_use_count.store(use_count, std::memory_order_relaxed);
+          return;
+        }
+        while (use_count > peak && !peak_use_count.compare_exchange_weak(peak, use_count, std::memory_order_relaxed)) {}
+      }
+
+      void AddTo(RefCountStatistics& statistics) const noexcept {
+        statistics.increments += increments.load(std::memory_order_relaxed);
+        statistics.decrements += decrements.load(std::memory_order_relaxed);
+        statistics.final_releases += final_releases.load(std::memory_order_relaxed);
+        statistics.try_increments += try_increments.load(std::memory_order_relaxed);
+        statistics.failed_try_increments += failed_try_increments.load(std::memory_order_relaxed);
+        statistics.peak_use_count = std::max<std::uint64_t>(statistics.peak_use_count, peak_use_count.load(std::memory_order_relaxed));
+      }
+
+      void Clear() noexcept {
+        increments.store(0, std::memory_order_relaxed);
+        decrements.store(0, std::memory_order_relaxed);
+        final_releases.store(0, std::memory_order_relaxed);
+        try_increments.store(0, std::memory_order_relaxed);
+        failed_try_increments.store(0, std::memory_order_relaxed);
+        peak_use_count.store(0, std::memory_order_relaxed);
+      }
+    };
+
+    // All thread blocks of one instrumented policy. Blocks of exited threads
+    // are folded into a retired block.
+    class RefCountStatsSource
+    {
+    public:
+      explicit RefCountStatsSource(char const* name)
+        : m_name(name)
+      {
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        Registry().push_back(this);
+      }
+
+      RefCountStatsSource(RefCountStatsSource const&) = delete;
+      RefCountStatsSource& operator= (RefCountStatsSource const&) = delete;
+
+      ~RefCountStatsSource() {
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        Registry().erase(std::remove(Registry().begin(), Registry().end(), this), Registry().end());
+      }
+
+      void Attach(RefCountStatsBlock* block) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        block->next = m_blocks;
+        m_blocks = block;
+      }
+
+      // Folds a thread's block into the retired totals.
+      void Detach(RefCountStatsBlock* block) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RefCountStatistics retired = Retired();
+        block->AddTo(retired);
+        StoreRetired(retired);
+        for (RefCountStatsBlock** link = &m_blocks; *link != nullptr; link = &(*link)->next) {
+          if (*link == block) {
+            *link = block->next;
+            break;
+          }
+        }
+      }
+
+      // Counts from threads whose block is gone, updated by several threads.
+      RefCountStatsBlock& Orphan() noexcept {
+        return m_orphan;
+      }
+
+      RefCountStatistics Collect() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RefCountStatistics statistics;
+        statistics.name = m_name;
+        m_retired.AddTo(statistics);
+        m_orphan.AddTo(statistics);
+        for (RefCountStatsBlock const* block = m_blocks; block != nullptr; block = block->next)
+          block->AddTo(statistics);
+        return statistics;
+      }
+
+      void Reset() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired.Clear();
+        m_orphan.Clear();
+        for (RefCountStatsBlock* block = m_blocks; block != nullptr; block = block->next)
+          block->Clear();
+      }
+
+      static std::vector<RefCountStatistics> CollectAll() {
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        std::vector<RefCountStatistics> all;
+        for (RefCountStatsSource const* source : Registry())
+          all.push_back(source->Collect());
+        return all;
+      }
+
+    private:
+      RefCountStatistics Retired() const noexcept {
+        RefCountStatistics retired;
+        m_retired.AddTo(retired);
+        return retired;
+      }
+
+      void StoreRetired(RefCountStatistics const& retired) noexcept {
+        m_retired.increments.store(retired.increments, std::memory_order_relaxed);
+        m_retired.decrements.store(retired.decrements, std::memory_order_relaxed);
+        m_retired.final_releases.store(retired.final_releases, std::memory_order_relaxed);
+        m_retired.try_increments.store(retired.try_increments, std::memory_order_relaxed);
+        m_retired.failed_try_increments.store(retired.failed_try_increments, std::memory_order_relaxed);
+        m_retired.peak_use_count.store(retired.peak_use_count, std::memory_order_relaxed);
+      }
+
+      static std::mutex& RegistryMutex() noexcept {
+        static std::mutex mutex;
+        return mutex;
+      }
+
+      static std::vector<RefCountStatsSource*>& Registry() noexcept {
+        static std::vector<RefCountStatsSource*> registry;
+        return registry;
+      }
+
+      char const* m_name;
+      mutable std::mutex m_mutex;
+      RefCountStatsBlock* m_blocks = nullptr;
+      RefCountStatsBlock m_retired;
+      RefCountStatsBlock m_orphan{ true };
+    };
+  } // namespace detail
+
+  // Wraps CounterPolicy and records, per thread, the increments, decrements,
+  // final releases, TryIncrement attempts and failures and the peak use
+  // count seen. Tag names the statistics, usually the counted type; it
+  // defaults to the policy. Bulk adjustments are recorded one by one.
+  //
+  // Contention is not measured. The compare-and-swap retries of the
+  // saturating and checked policies and of BiasedCounter happen inside the
+  // wrapped policy, out of sight of the wrapper, and counting them there
+  // would cost every build. Use the all-threads benchmarks or a profiler.
+  template<typename CounterPolicy, typename Tag = void>
+  struct InstrumentedCounter
+    : CounterPolicy
+  {
+    typedef typename CounterPolicy::Type Type;
+    typedef decltype(CounterPolicy::Load(std::declval<Type const&>())) CountType;
+
+    static void Increment(Type& counter) noexcept
+    {
+      CounterPolicy::Increment(counter);
+      detail::RefCountStatsBlock& block = Local();
+      block.Bump(block.increments);
+      block.RecordUseCount(CounterPolicy::Load(counter));
+    }
+
+    static CountType Decrement(Type& counter) noexcept
+    {
+      detail::RefCountStatsBlock& block = Local();
+      CountType result = CounterPolicy::Decrement(counter);
+      block.Bump(block.decrements);
+      if (result == 0)
+        block.Bump(block.final_releases);
+      return result;
+    }
+
+    static bool IncrementIfNonZero(Type& counter) noexcept
+    {
+      bool incremented = CounterPolicy::IncrementIfNonZero(counter);
+      detail::RefCountStatsBlock& block = Local();
+      block.Bump(block.try_increments);
+      if (incremented)
+        block.RecordUseCount(CounterPolicy::Load(counter));
+      else
+        block.Bump(block.failed_try_increments);
+      return incremented;
+    }
+
+    // Merges the counters of every thread.
+    static RefCountStatistics Statistics()
+    {
+      return Source().Collect();
+    }
+
+    static void ResetStatistics()
+    {
+      Source().Reset();
+    }
+
+  private:
+    typedef typename std::conditional<std::is_void<Tag>::value, CounterPolicy, Tag>::type NameType;
+
+    static detail::RefCountStatsSource& Source()
+    {
+      static detail::RefCountStatsSource source(typeid(NameType).name());
+      return source;
+    }
+
+    class Holder
+    {
+    public:
+      explicit Holder(detail::RefCountStatsBlock*& block)
+        : m_block(block)
+      {
+        Source().Attach(m_block);
+      }
+
+      ~Holder() {
+        Source().Detach(m_block);
+        delete m_block;
+        m_block = &Source().Orphan();
+      }
+
+    private:
+      detail::RefCountStatsBlock*& m_block;
+    };
+
+    static detail::RefCountStatsBlock& Local()
+    {
+      static thread_local detail::RefCountStatsBlock* block = nullptr;
+      if (block == nullptr) {
+        block = new detail::RefCountStatsBlock;
+        static thread_local Holder holder(block);
+      }
+      return *block;
+    }
+  };
+
+  // InstrumentedCounter when built with REF_COUNTER_STATS, CounterPolicy
+  // itself otherwise, so instrumented types cost nothing in normal builds.
+  template<typename CounterPolicy, typename Tag = void>
+  using OptionalInstrumentedCounter = typename std::conditional<REF_COUNTER_STATS != 0, InstrumentedCounter<CounterPolicy, Tag>, CounterPolicy>::type;
+
+  inline std::vector<RefCountStatistics> CollectRefCountStatistics()
+  {
+    return detail::RefCountStatsSource::CollectAll();
+  }
+
+  // One line per instrumented policy.
+  inline void WriteRefCountReport(std::ostream& os)
+  {
+    for (RefCountStatistics const& statistics : CollectRefCountStatistics()) {
+      os << statistics.name
+         << ": increments=" << statistics.increments
+         << " decrements=" << statistics.decrements
+         << " final_releases=" << statistics.final_releases
+         << " try_increments=" << statistics.try_increments
+         << " failed_try_increments=" << statistics.failed_try_increments
+         << " peak_use_count=" << statistics.peak_use_count
+         << '\n';
+    }
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_STATS_H_
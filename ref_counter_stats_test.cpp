@@ -0,0 +1,59 @@
+#include "catch.hpp"
+#include "ref_counter_stats.h"
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+using ref_counter::InstrumentedCounter;
+using ref_counter::OptionalInstrumentedCounter;
+using ref_counter::RefCountStatistics;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterWeakPtr;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::WeakRefCounter;
+using ref_counter::WriteRefCountReport;
+
+class InstrumentedNode
+  : public WeakRefCounter<InstrumentedCounter<ThreadSafeCounter, class InstrumentedNode>>
+{
+protected:
+  virtual ~InstrumentedNode() = default;
+};
+
+typedef InstrumentedCounter<ThreadSafeCounter, InstrumentedNode> InstrumentedNodeCounter;
+
+TEST_CASE("Test Instrumented Counter") {
+#if !REF_COUNTER_STATS
+  static_assert(std::is_same<OptionalInstrumentedCounter<ThreadSafeCounter, InstrumentedNode>, ThreadSafeCounter>::value, "disabled instrumentation is the plain policy");
+#endif
+
+  InstrumentedNodeCounter::ResetStatistics();
+  RefCounterWeakPtr<InstrumentedNode> weak;
+  {
+    RefCounterPtr<InstrumentedNode> node(new InstrumentedNode);
+    weak = node;
+    {
+      RefCounterPtr<InstrumentedNode> a = node;
+      RefCounterPtr<InstrumentedNode> b = node;
+    }
+    std::thread([&] {
+      RefCounterPtr<InstrumentedNode> copy = node;
+      RefCounterPtr<InstrumentedNode> locked = weak.Lock();
+    }).join();
+  }
+  CHECK(!weak.Lock());
+
+  RefCountStatistics statistics = InstrumentedNodeCounter::Statistics();
+  CHECK(statistics.increments == 4);
+  CHECK(statistics.try_increments == 1);
+  CHECK(statistics.failed_try_increments == 0);
+  CHECK(statistics.decrements == 5);
+  CHECK(statistics.final_releases == 1);
+  CHECK(statistics.peak_use_count == 3);
+
+  std::ostringstream report;
+  WriteRefCountReport(report);
+  CHECK(report.str().find("InstrumentedNode") != std::string::npos);
+  CHECK(report.str().find("final_releases=1") != std::string::npos);
+}
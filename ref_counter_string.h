@@ -0,0 +1,241 @@
+#ifndef REF_COUNTER_STRING_H_
+#define REF_COUNTER_STRING_H_
+
+#include "ref_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+namespace ref_counter
+{
+  namespace detail
+  {
+    // Count, length, cached hash and the elements in one allocation; the
+    // elements follow the header and are terminated by Char().
+    template<typename Char>
+    class RefStringBuffer
+      : public RefCounterBase<RefStringBuffer<Char>>
+    {
+    public:
+      static RefStringBuffer* Create(Char const* data, std::size_t size)
+      {
+        void* storage = ::operator new(sizeof(RefStringBuffer) + (size + 1) * sizeof(Char));
+        RefStringBuffer* buffer = new (storage) RefStringBuffer(size);
+        std::copy(data, data + size, buffer->Data());
+        buffer->Data()[size] = Char();
+        return buffer;
+      }
+
+      Char* Data() noexcept
+      {
+        return reinterpret_cast<Char*>(this + 1);
+      }
+
+      std::size_t Size() const noexcept
+      {
+        return m_size;
+      }
+
+      // Computed by the first caller; racing callers store the same value.
+      template<class Hasher>
+      std::size_t Hash(Hasher hasher) noexcept
+      {
+        if (m_hashed.load(std::memory_order_acquire))
+          return m_hash.load(std::memory_order_relaxed);
+        std::size_t hash = hasher(Data(), m_size);
+        m_hash.store(hash, std::memory_order_relaxed);
+        m_hashed.store(true, std::memory_order_release);
+        return hash;
+      }
+
+    private:
+      friend class RefCounterBase<RefStringBuffer<Char>>;
+
+      explicit RefStringBuffer(std::size_t size) noexcept
+        : m_size(size)
+      {
+      }
+
+      ~RefStringBuffer() = default;
+
+      void OnFinalDestroy()
+      {
+        this->~RefStringBuffer();
+        ::operator delete(static_cast<void*>(this));
+      }
+
+      // The flag fills the padding after the count.
+      std::atomic<bool> m_hashed{ false };
+      std::size_t m_size;
+      std::atomic<std::size_t> m_hash{ 0 };
+    };
+  } // namespace detail
+
+  // Immutable shared sequence of Char stored in a single allocation with its
+  // count, see RefString and RefBytes. Copies share the buffer; Substr
+  // makes a view into the same buffer without copying. The hash of a whole
+  // buffer is computed once and cached in it, a slice hashes its range on
+  // every call.
+  template<typename Char>
+  class BasicRefString
+  {
+  private:
+    typedef detail::RefStringBuffer<Char> BufferType;
+
+  public:
+    typedef Char value_type;
+    typedef Char const* const_iterator;
+    typedef std::size_t size_type;
+
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+    BasicRefString() noexcept = default;
+
+    BasicRefString(Char const* data, size_type size)
+      : m_buffer(BufferType::Create(data, size))
+      , m_data(m_buffer->Data())
+      , m_size(size)
+    {
+    }
+
+    template<class C = Char, typename std::enable_if<std::is_same<C, char>::value, int>::type = 0>
+    explicit BasicRefString(std::string_view text)
+      : BasicRefString(text.data(), text.size())
+    {
+    }
+
+    Char const* data() const noexcept
+    {
+      return m_data;
+    }
+
+    size_type size() const noexcept
+    {
+      return m_size;
+    }
+
+    bool empty() const noexcept
+    {
+      return m_size == 0;
+    }
+
+    const_iterator begin() const noexcept
+    {
+      return m_data;
+    }
+
+    const_iterator end() const noexcept
+    {
+      return m_data + m_size;
+    }
+
+    Char operator[](size_type pos) const noexcept
+    {
+      assert(pos < m_size);
+      return m_data[pos];
+    }
+
+    template<class C = Char, typename std::enable_if<std::is_same<C, char>::value, int>::type = 0>
+    std::string_view View() const noexcept
+    {
+      return std::string_view(m_data, m_size);
+    }
+
+    // A view of [pos, pos + count) sharing this buffer.
+    BasicRefString Substr(size_type pos, size_type count = npos) const
+    {
+      if (pos > m_size)
+        throw std::out_of_range("BasicRefString::Substr");
+      BasicRefString slice(*this);
+      slice.m_data += pos;
+      slice.m_size = std::min(count, m_size - pos);
+      return slice;
+    }
+
+    // True when this covers its whole buffer, so the hash is cached and the
+    // elements are terminated.
+    bool IsWhole() const noexcept
+    {
+      return !m_buffer || (m_data == m_buffer->Data() && m_size == m_buffer->Size());
+    }
+
+    // Copies a slice into a buffer of its own, e.g. to let a small slice of a
+    // large buffer outlive it.
+    BasicRefString Compact() const
+    {
+      return IsWhole() ? *this : BasicRefString(m_data, m_size);
+    }
+
+    std::size_t Hash() const noexcept
+    {
+      if (m_buffer && IsWhole())
+        return m_buffer->Hash(&HashRange);
+      return HashRange(m_data, m_size);
+    }
+
+    friend bool operator==(BasicRefString const& a, BasicRefString const& b) noexcept
+    {
+      if (a.m_size != b.m_size)
+        return false;
+      if (a.m_data == b.m_data)
+        return true;
+      if (a.IsWhole() && b.IsWhole() && a.Hash() != b.Hash())
+        return false;
+      return std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(BasicRefString const& a, BasicRefString const& b) noexcept
+    {
+      return !(a == b);
+    }
+
+    friend bool operator<(BasicRefString const& a, BasicRefString const& b) noexcept
+    {
+      return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    }
+
+    void swap(BasicRefString& rhs) noexcept
+    {
+      m_buffer.swap(rhs.m_buffer);
+      std::swap(m_data, rhs.m_data);
+      std::swap(m_size, rhs.m_size);
+    }
+
+  private:
+    static std::size_t HashRange(Char const* data, size_type size) noexcept
+    {
+      return std::hash<std::string_view>()(std::string_view(reinterpret_cast<char const*>(data), size * sizeof(Char)));
+    }
+
+    RefCounterPtr<BufferType> m_buffer;
+    Char const* m_data = nullptr;
+    size_type m_size = 0;
+  };
+
+  template<typename Char> void swap(BasicRefString<Char>& lhs, BasicRefString<Char>& rhs) noexcept
+  {
+    lhs.swap(rhs);
+  }
+
+  typedef BasicRefString<char> RefString;
+  typedef BasicRefString<unsigned char> RefBytes;
+
+} // namespace ref_counter
+
+namespace std
+{
+  template<typename Char> struct hash< ref_counter::BasicRefString<Char> >
+  {
+    std::size_t operator()(ref_counter::BasicRefString<Char> const& s) const noexcept
+    {
+      return s.Hash();
+    }
+  };
+}
+
+#endif // REF_COUNTER_STRING_H_
@@ -0,0 +1,78 @@
+#include "catch.hpp"
+#include "ref_counter_string.h"
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+using ref_counter::RefBytes;
+using ref_counter::RefString;
+
+TEST_CASE("Test RefString") {
+  RefString empty;
+  CHECK(empty.empty());
+  CHECK(empty == RefString(""));
+
+  RefString hello("hello world");
+  CHECK(hello.size() == 11);
+  CHECK(hello.View() == "hello world");
+  CHECK(hello.data()[hello.size()] == '\0');
+  CHECK(hello.IsWhole());
+
+  RefString copy = hello;
+  CHECK(copy.data() == hello.data());
+  CHECK(copy == hello);
+  CHECK(RefString("hello world") == hello);
+  CHECK(RefString("hello") < hello);
+  CHECK(RefString("help") != hello);
+}
+
+TEST_CASE("Test RefString Slices") {
+  RefString text("key=value");
+  RefString key = text.Substr(0, 3);
+  RefString value = text.Substr(4);
+  CHECK(key.View() == "key");
+  CHECK(value.View() == "value");
+  CHECK(key.data() == text.data());
+  CHECK(!key.IsWhole());
+  CHECK(text.Substr(9).empty());
+  CHECK_THROWS_AS(text.Substr(10), std::out_of_range);
+
+  // A slice outlives the string it was taken from.
+  text = RefString();
+  CHECK(value.View() == "value");
+
+  RefString compact = value.Compact();
+  CHECK(compact.IsWhole());
+  CHECK(compact.data() != value.data());
+  CHECK(compact == value);
+  CHECK(compact.Hash() == value.Hash());
+  CHECK(compact.Hash() == std::hash<std::string_view>()("value"));
+}
+
+TEST_CASE("Test RefString As Key") {
+  std::unordered_map<RefString, int> counts;
+  RefString line("a b a c a");
+  for (std::size_t pos = 0; pos < line.size(); pos += 2)
+    ++counts[line.Substr(pos, 1).Compact()];
+  CHECK(counts.size() == 3);
+  CHECK(counts[RefString("a")] == 3);
+  CHECK(counts[RefString("c")] == 1);
+
+  std::unordered_set<RefString> keys;
+  keys.insert(RefString("x"));
+  CHECK(keys.count(RefString("x").Compact()) == 1);
+  CHECK(keys.count(RefString("y")) == 0);
+}
+
+TEST_CASE("Test RefBytes") {
+  unsigned char const raw[] = { 0, 1, 2, 255 };
+  RefBytes bytes(raw, sizeof(raw));
+  CHECK(bytes.size() == 4);
+  CHECK(bytes[3] == 255);
+  RefBytes tail = bytes.Substr(2);
+  CHECK(tail.size() == 2);
+  CHECK(tail[0] == 2);
+  CHECK(tail == RefBytes(raw + 2, 2));
+  CHECK(std::hash<RefBytes>()(tail) == RefBytes(raw + 2, 2).Hash());
+}
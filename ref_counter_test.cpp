@@ -10,16 +10,41 @@
 
 #include "catch.hpp"
 #include "ref_counter.h"
+#include "ref_counter_test_fixtures.h"
 #include <string>
 #include <unordered_map>
 #include <memory>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <thread>
+#include <vector>
 
 using ref_counter::RefCounter;
+using ref_counter::RefCounterBase;
+using ref_counter::MakeRefFor;
+using ref_counter::RefCounterPtrFor;
 using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterRef;
+using ref_counter::ReleaseWorklist;
 using ref_counter::ThreadUnsafeCounter;
 using ref_counter::ThreadSafeCounter;
+using ref_counter::BiasedCounter;
+using ref_counter::CacheAlignedCounter;
+using ref_counter::PackedThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter16;
+using ref_counter::ThreadUnsafeCounter64;
+using ref_counter::ThreadSafeCounter16;
+using ref_counter::ThreadSafeCounter32;
+using ref_counter::ThreadSafeCounter64;
+using ref_counter::SaturatingThreadUnsafeCounter;
+using ref_counter::SaturatingThreadSafeCounter;
+using ref_counter::CheckedThreadSafeCounter;
+using ref_counter::kCacheLineSize;
+using ref_counter::WeakRefCounter;
+using ref_counter::ImmortalCounter;
+using ref_counter::kImmortal;
+using ref_counter::RefCounterWeakPtr;
 
 class ReferenceCounted0
   : public RefCounter<>
@@ -252,3 +277,777 @@ TEST_CASE("Test STL compatibility") {
   test_stream << std::hash<TestInterface1*>()(obj.Get());
   CHECK(test_stream.str() == str);
 }
+
+class WeakInterface
+  : virtual public WeakRefCounter<ThreadSafeCounter>
+{
+public:
+  virtual int Value() = 0;
+
+protected:
+  virtual ~WeakInterface() = default;
+};
+
+class WeakReferenced
+  : public WeakInterface
+{
+public:
+  static std::atomic<int> alive;
+
+  WeakReferenced(int v) : value(v)
+  {
+    ++alive;
+  }
+
+  virtual int Value() override {
+    return value;
+  }
+
+protected:
+  virtual ~WeakReferenced() {
+    --alive;
+  }
+
+private:
+  int value;
+};
+
+std::atomic<int> WeakReferenced::alive(0);
+
+TEST_CASE("Test Weak Reference") {
+  CHECK(sizeof(ReferenceCounted0) == sizeof(RefCounter<>));
+  RefCounterWeakPtr<WeakInterface> weak;
+  CHECK(weak.Expired());
+  CHECK(!weak.Lock());
+  {
+    RefCounterPtr<WeakReferenced> strong(new WeakReferenced(7));
+    weak = strong;
+    RefCounterWeakPtr<WeakInterface> another = weak;
+    CHECK(!weak.Expired());
+    CHECK(strong->UseCount() == 1);
+    RefCounterPtr<WeakInterface> locked = another.Lock();
+    CHECK(locked);
+    CHECK(locked->Value() == 7);
+    CHECK(strong->UseCount() == 2);
+  }
+  CHECK(WeakReferenced::alive == 0);
+  CHECK(weak.Expired());
+  CHECK(!weak.Lock());
+  weak.Reset();
+  CHECK(weak.Expired());
+}
+
+TEST_CASE("Test Weak Reference Race") {
+  for (int round = 0; round < 50; ++round) {
+    RefCounterPtr<WeakInterface> strong(new WeakReferenced(round));
+    RefCounterWeakPtr<WeakInterface> weak(strong);
+    std::atomic<bool> start(false);
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> lockers;
+    for (int i = 0; i < 4; ++i) {
+      lockers.emplace_back([&] {
+        while (!start) {}
+        while (RefCounterPtr<WeakInterface> locked = weak.Lock()) {
+          if (locked->Value() != round)
+            ++mismatches;
+        }
+      });
+    }
+    start = true;
+    strong.Reset();
+    for (std::thread& locker : lockers)
+      locker.join();
+    CHECK(mismatches == 0);
+    CHECK(weak.Expired());
+    CHECK(WeakReferenced::alive == 0);
+  }
+}
+
+class BiasedCounted
+  : public WeakRefCounter<BiasedCounter>
+{
+public:
+  static std::atomic<int> alive;
+
+  BiasedCounted()
+  {
+    ++alive;
+  }
+
+protected:
+  virtual ~BiasedCounted() {
+    --alive;
+  }
+};
+
+std::atomic<int> BiasedCounted::alive(0);
+
+TEST_CASE("Test Biased Counter") {
+  RefCounterPtr<BiasedCounted> owner(new BiasedCounted);
+  CHECK(owner->UseCount() == 1);
+  {
+    RefCounterPtr<BiasedCounted> copy = owner;
+    CHECK(owner->UseCount() == 2);
+  }
+  CHECK(owner->UseCount() == 1);
+  RefCounterPtr<BiasedCounted> shared;
+  std::thread([&] {
+    shared = owner;
+    CHECK(owner->UseCount() >= 1);
+  }).join();
+  CHECK(owner->UseCount() == 2);
+  owner.Reset();
+  CHECK(BiasedCounted::alive == 1);
+  CHECK(shared->UseCount() == 1);
+  RefCounterWeakPtr<BiasedCounted> weak(shared);
+  std::thread([&] {
+    shared.Reset();
+  }).join();
+  CHECK(BiasedCounted::alive == 0);
+  CHECK(!weak.Lock());
+}
+
+TEST_CASE("Test Biased Counter Race") {
+  for (int round = 0; round < 50; ++round) {
+    RefCounterPtr<BiasedCounted> owner(new BiasedCounted);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([copy = owner]() mutable {
+        for (int j = 0; j < 1000; ++j) {
+          RefCounterPtr<BiasedCounted> another = copy;
+          copy = another;
+        }
+        copy.Reset();
+      });
+    }
+    owner.Reset();
+    for (std::thread& thread : threads)
+      thread.join();
+    BiasedCounter::ProcessQueuedMerges();
+    CHECK(BiasedCounted::alive == 0);
+  }
+}
+
+TEST_CASE("Test Biased Counter Owner Exit") {
+  RefCounterPtr<BiasedCounted> shared;
+  std::thread([&] {
+    RefCounterPtr<BiasedCounted> owner(new BiasedCounted);
+    shared = owner;
+  }).join();
+  CHECK(BiasedCounted::alive == 1);
+  CHECK(shared->UseCount() == 1);
+  std::thread([&] {
+    shared.Reset();
+  }).join();
+  CHECK(BiasedCounted::alive == 0);
+}
+
+TEST_CASE("Test Biased Counter Owner Exit During Merge Request") {
+  for (int round = 0; round < 200; ++round) {
+    std::atomic<BiasedCounted*> published{ nullptr };
+    std::atomic<int> copied{ 0 };
+    std::atomic<bool> go{ false };
+    std::thread owner([&] {
+      RefCounterPtr<BiasedCounted> object(new BiasedCounted);
+      published = object.Get();
+      while (copied != 4) {}
+      go = true;
+      // Vary whether the owner merges before or after the others queue it.
+      for (int spin = 0; spin < round % 8; ++spin)
+        std::this_thread::yield();
+      object.Reset();
+    });
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&] {
+        BiasedCounted* raw;
+        while ((raw = published.load()) == nullptr) {}
+        RefCounterPtr<BiasedCounted> copy(raw);
+        ++copied;
+        while (!go) {}
+        copy.Reset();
+      });
+    }
+    owner.join();
+    for (std::thread& thread : threads)
+      thread.join();
+    CHECK(BiasedCounted::alive == 0);
+  }
+}
+
+class CacheAlignedCounted
+  : public RefCounter<CacheAlignedCounter>
+{
+public:
+  int hot = 0;
+
+protected:
+  virtual ~CacheAlignedCounted() = default;
+};
+
+class PackedCounted
+  : public RefCounter<PackedThreadSafeCounter>
+{
+public:
+  int hot = 0;
+
+protected:
+  virtual ~PackedCounted() = default;
+};
+
+TEST_CASE("Test Counter Layout") {
+  static_assert(sizeof(RefCounter<PackedThreadSafeCounter>) <= 2 * sizeof(void*), "packed counter sits next to the vptr");
+  static_assert(alignof(CacheAlignedCounted) == kCacheLineSize, "cache aligned counter aligns the object");
+  static_assert(sizeof(RefCounter<CacheAlignedCounter>) == 2 * kCacheLineSize, "cache aligned counter fills its own line");
+
+  RefCounterPtr<CacheAlignedCounted> aligned(new CacheAlignedCounted);
+  CHECK(reinterpret_cast<std::uintptr_t>(aligned.Get()) % kCacheLineSize == 0);
+  CHECK(reinterpret_cast<char*>(&aligned->hot) - reinterpret_cast<char*>(aligned.Get()) >= static_cast<std::ptrdiff_t>(2 * kCacheLineSize));
+  RefCounterPtr<CacheAlignedCounted> copy = aligned;
+  CHECK(aligned->UseCount() == 2);
+  copy.Reset();
+  CHECK(aligned->UseCount() == 1);
+
+  RefCounterPtr<PackedCounted> packed(new PackedCounted);
+  CHECK(reinterpret_cast<char*>(&packed->hot) - reinterpret_cast<char*>(packed.Get()) <= static_cast<std::ptrdiff_t>(2 * sizeof(void*)));
+  CHECK(packed->UseCount() == 1);
+}
+
+template<typename CounterPolicy>
+class TinyNode
+  : public RefCounter<CounterPolicy>
+{
+public:
+  char payload[6] = {};
+
+protected:
+  virtual ~TinyNode() = default;
+};
+
+TEST_CASE("Test Counter Widths") {
+  static_assert(std::is_same<RefCounter<ThreadSafeCounter16>::CountType, std::uint16_t>::value, "16-bit count");
+  static_assert(std::is_same<RefCounter<ThreadSafeCounter64>::CountType, std::uint64_t>::value, "64-bit count");
+  static_assert(std::is_same<RefCounter<ThreadSafeCounter>::CountType, unsigned int>::value, "default count");
+  static_assert(sizeof(ThreadSafeCounter16::Type) == 2, "16-bit counter");
+  static_assert(sizeof(ThreadSafeCounter64::Type) == 8, "64-bit counter");
+
+  // Bytes per object with a vptr and six bytes of payload; where the ABI
+  // reuses base class padding the 16-bit count saves a word per object.
+  CAPTURE(sizeof(TinyNode<ThreadSafeCounter16>), sizeof(TinyNode<ThreadSafeCounter32>), sizeof(TinyNode<ThreadSafeCounter64>));
+  CHECK(sizeof(TinyNode<ThreadSafeCounter16>) <= sizeof(TinyNode<ThreadSafeCounter32>));
+  CHECK(sizeof(TinyNode<ThreadSafeCounter32>) <= sizeof(TinyNode<ThreadSafeCounter64>));
+  CHECK(sizeof(TinyNode<ThreadUnsafeCounter16>) <= sizeof(TinyNode<ThreadUnsafeCounter64>));
+
+  RefCounterPtr<TinyNode<ThreadSafeCounter16>> small(new TinyNode<ThreadSafeCounter16>);
+  RefCounterPtr<TinyNode<ThreadSafeCounter16>> copy = small;
+  CHECK(small->UseCount() == 2);
+  RefCounterPtr<TinyNode<ThreadUnsafeCounter64>> wide(new TinyNode<ThreadUnsafeCounter64>);
+  CHECK(wide->UseCount() == 1);
+}
+
+class SaturatedNode
+  : public RefCounter<SaturatingThreadSafeCounter<std::uint16_t>>
+{
+public:
+  static int alive;
+
+  SaturatedNode()
+  {
+    ++alive;
+  }
+
+  static void Destroy(SaturatedNode* node) {
+    delete node;
+  }
+
+protected:
+  virtual ~SaturatedNode() {
+    --alive;
+  }
+};
+
+int SaturatedNode::alive = 0;
+
+TEST_CASE("Test Counter Overflow") {
+  typedef SaturatingThreadSafeCounter<std::uint16_t> Saturating;
+  Saturating::Type saturating(65534);
+  Saturating::Increment(saturating);
+  CHECK(Saturating::Load(saturating) == 65535);
+  Saturating::Increment(saturating);
+  CHECK(Saturating::Load(saturating) == 65535);
+  CHECK(Saturating::Decrement(saturating) == 65535);
+  CHECK(Saturating::IncrementIfNonZero(saturating));
+  CHECK(Saturating::Load(saturating) == 65535);
+
+  typedef SaturatingThreadUnsafeCounter<std::uint16_t> UnsafeSaturating;
+  UnsafeSaturating::Type unsafe_saturating = 65535;
+  UnsafeSaturating::Increment(unsafe_saturating);
+  CHECK(UnsafeSaturating::Decrement(unsafe_saturating) == 65535);
+
+  // A saturated object is never destroyed through its count.
+  RefCounterPtr<SaturatedNode> immortal(new SaturatedNode);
+  for (int i = 0; i < 70000; ++i)
+    (void)RefCounterPtr<SaturatedNode>(immortal).Detach();
+  CHECK(immortal->UseCount() == 65535);
+  SaturatedNode* raw = immortal.Get();
+  immortal.Reset();
+  CHECK(SaturatedNode::alive == 1);
+  SaturatedNode::Destroy(raw);
+
+  typedef CheckedThreadSafeCounter<std::uint16_t> Checked;
+  Checked::Type checked(1);
+  Checked::Increment(checked);
+  CHECK(Checked::Decrement(checked) == 1);
+  CHECK(Checked::Decrement(checked) == 0);
+  CHECK(!Checked::IncrementIfNonZero(checked));
+}
+
+class ValueNode
+  : public RefCounterBase<ValueNode, ThreadUnsafeCounter>
+{
+public:
+  static int alive;
+
+  ValueNode(int v) : value(v)
+  {
+    ++alive;
+  }
+
+  int value;
+
+private:
+  friend class RefCounterBase<ValueNode, ThreadUnsafeCounter>;
+
+  ~ValueNode() {
+    --alive;
+  }
+};
+
+int ValueNode::alive = 0;
+
+class RecycledNode
+  : public RefCounterBase<RecycledNode>
+{
+public:
+  static int recycled;
+
+  void OnFinalDestroy() {
+    ++recycled;
+  }
+};
+
+int RecycledNode::recycled = 0;
+
+TEST_CASE("Test Non-Virtual RefCounterBase") {
+  static_assert(!std::is_polymorphic<ValueNode>::value, "no vptr");
+  static_assert(sizeof(ValueNode) == sizeof(unsigned int) + sizeof(int), "count and payload only");
+  {
+    RefCounterPtr<ValueNode> node(new ValueNode(7));
+    RefCounterPtr<ValueNode> copy = node;
+    CHECK(node->UseCount() == 2);
+    CHECK(copy->value == 7);
+    std::unordered_map<RefCounterPtr<ValueNode>, int> map;
+    map[node] = 1;
+    CHECK(map[copy] == 1);
+  }
+  CHECK(ValueNode::alive == 0);
+
+  RecycledNode storage;
+  {
+    RefCounterPtr<RecycledNode> node(&storage);
+    CHECK(node->UseCount() == 1);
+  }
+  CHECK(RecycledNode::recycled == 1);
+}
+
+class ThirdPartyFinal final
+{
+public:
+  ThirdPartyFinal(int a, int b) : sum(a + b)
+  {
+  }
+
+  int sum;
+};
+
+TEST_CASE("Test MakeRefFor") {
+  RefCounterPtrFor<std::string> text = MakeRefFor<std::string>(3, 'x');
+  CHECK(*text == "xxx");
+  CHECK(text->size() == 3);
+  text->append("y");
+  RefCounterPtrFor<std::string> copy = text;
+  CHECK(copy->Value() == "xxxy");
+  CHECK(text->UseCount() == 2);
+
+  RefCounterPtrFor<int, ThreadUnsafeCounter> number = MakeRefFor<int, ThreadUnsafeCounter>(42);
+  CHECK(number->Value() == 42);
+  static_assert(sizeof(*number) == sizeof(unsigned int) + sizeof(int), "count and value share one block");
+
+  RefCounterPtrFor<ThirdPartyFinal> final_type = MakeRefFor<ThirdPartyFinal>(2, 3);
+  CHECK(final_type->Value().sum == 5);
+
+  std::vector<RefCounterPtrFor<std::vector<int>>> vectors;
+  vectors.push_back(MakeRefFor<std::vector<int>>(4, 1));
+  CHECK(vectors[0]->size() == 4);
+}
+
+class ChainNode
+  : public RefCounter<>
+{
+public:
+  static int alive;
+
+  explicit ChainNode(RefCounterPtr<ChainNode> next) : next(std::move(next))
+  {
+    ++alive;
+  }
+
+  RefCounterPtr<ChainNode> next;
+
+protected:
+  virtual ~ChainNode() {
+    --alive;
+  }
+
+  virtual void ReleaseChildren(ReleaseWorklist& children) override {
+    children.Add(next);
+  }
+};
+
+int ChainNode::alive = 0;
+
+class TreeNode
+  : public RefCounterBase<TreeNode, ThreadUnsafeCounter>
+{
+public:
+  static int alive;
+
+  TreeNode()
+  {
+    ++alive;
+  }
+
+  std::vector<RefCounterPtr<TreeNode>> children;
+
+private:
+  friend class RefCounterBase<TreeNode, ThreadUnsafeCounter>;
+
+  ~TreeNode() {
+    --alive;
+  }
+
+  void ReleaseChildren(ReleaseWorklist& worklist) {
+    for (RefCounterPtr<TreeNode>& child : children)
+      worklist.Add(child);
+  }
+};
+
+int TreeNode::alive = 0;
+
+TEST_CASE("Test Iterative Release") {
+  // Far deeper than the destructors could recurse on a thread's stack.
+  static constexpr int kLength = 1000000;
+  std::thread([] {
+    RefCounterPtr<ChainNode> head;
+    for (int i = 0; i < kLength; ++i)
+      head = RefCounterPtr<ChainNode>(new ChainNode(std::move(head)));
+    CHECK(ChainNode::alive == kLength);
+    head.Reset();
+    CHECK(ChainNode::alive == 0);
+  }).join();
+
+  // Shared children survive until their last owner is gone.
+  RefCounterPtr<TreeNode> root(new TreeNode);
+  RefCounterPtr<TreeNode> shared(new TreeNode);
+  for (int i = 0; i < 3; ++i) {
+    root->children.push_back(RefCounterPtr<TreeNode>(new TreeNode));
+    root->children.back()->children.push_back(shared);
+  }
+  CHECK(TreeNode::alive == 5);
+  root.Reset();
+  CHECK(TreeNode::alive == 1);
+  CHECK(shared->UseCount() == 1);
+  shared.Reset();
+  CHECK(TreeNode::alive == 0);
+}
+
+TEST_CASE("Test Iterative Release After Worklist Teardown") {
+  std::thread([] {
+    // Thread-local objects are destroyed in reverse order of construction,
+    // so the worklist goes first and the chain is released after it.
+    static thread_local RefCounterPtr<ChainNode> chain;
+    ReleaseWorklist::Current();
+    for (int i = 0; i < 100; ++i)
+      chain = RefCounterPtr<ChainNode>(new ChainNode(std::move(chain)));
+  }).join();
+  CHECK(ChainNode::alive == 0);
+}
+
+TEST_CASE("Test Iterative Release Step Limit") {
+  ReleaseWorklist& worklist = ReleaseWorklist::Current();
+  worklist.SetStepLimit(10);
+  RefCounterPtr<ChainNode> head;
+  for (int i = 0; i < 100; ++i)
+    head = RefCounterPtr<ChainNode>(new ChainNode(std::move(head)));
+
+  // The head and ten more nodes go now, the rest on later steps.
+  head.Reset();
+  CHECK(ChainNode::alive == 89);
+  CHECK(worklist.Pending() == 1);
+  RefCounterPtr<ChainNode> other(new ChainNode(RefCounterPtr<ChainNode>()));
+  other.Reset();
+  CHECK(ChainNode::alive == 79);
+
+  worklist.SetStepLimit(SIZE_MAX);
+  CHECK(worklist.Run() == 79);
+  CHECK(ChainNode::alive == 0);
+  CHECK(worklist.Pending() == 0);
+}
+
+namespace
+{
+  int Borrow(RefCounterRef<TestInterface1> ref) {
+    return ref->Test1() + static_cast<int>(ref->UseCount());
+  }
+
+  RefCounterPtr<TestInterface1> Keep(RefCounterRef<TestInterface1> ref) {
+    return ref.Share();
+  }
+}
+
+TEST_CASE("Test RefCounterRef") {
+  RefCounterPtr<ReferenceCounted1> ptr(new ReferenceCounted1(10));
+
+  // Borrowing, including the derived to base conversion, leaves the count alone.
+  CHECK(Borrow(ptr) == 11);
+  RefCounterRef<ReferenceCounted1> derived = ptr;
+  RefCounterRef<TestInterface1> base = derived;
+  CHECK(base == ptr);
+  CHECK(ptr == base);
+  CHECK(Borrow(base) == 11);
+  CHECK(Borrow(RefCounterRef<TestInterface1>(ptr.Get())) == 11);
+
+  // Only Share adds a reference.
+  RefCounterPtr<TestInterface1> kept = Keep(ptr);
+  CHECK(kept == ptr);
+  CHECK(ptr->UseCount() == 2);
+
+  RefCounterRef<TestInterface1> empty = nullptr;
+  CHECK(!empty);
+  CHECK(empty != base);
+  CHECK(!empty.Share());
+
+  static_assert(std::is_convertible<RefCounterPtr<ReferenceCounted1>&, RefCounterRef<TestInterface1>>::value, "borrows from lvalues");
+  static_assert(!std::is_convertible<RefCounterPtr<ReferenceCounted1>, RefCounterRef<TestInterface1>>::value, "no borrow from temporaries");
+  static_assert(!std::is_convertible<ReferenceCounted1*, RefCounterRef<TestInterface1>>::value, "raw pointers only explicitly");
+  static_assert(!std::is_convertible<RefCounterRef<TestInterface1>, RefCounterPtr<TestInterface1>>::value, "upgrading is explicit");
+  static_assert(sizeof(RefCounterRef<TestInterface1>) == sizeof(void*), "a borrow is a pointer");
+}
+
+namespace
+{
+  typedef ref_counter_test::CountingCounter<ThreadSafeCounter> CountingCounter;
+
+  class CountedBase
+    : public RefCounter<CountingCounter>
+  {
+  protected:
+    virtual ~CountedBase() = default;
+  };
+
+  class CountedDerived
+    : public CountedBase
+  {
+  };
+
+  class CountedOther
+    : public CountedBase
+  {
+  };
+
+  // Read-modify-writes made by f.
+  template<class Function>
+  int CountRmws(Function f) {
+    int before = CountingCounter::Updates();
+    f();
+    return CountingCounter::Updates() - before;
+  }
+}
+
+TEST_CASE("Test RefCounterPtr Redundant Count Updates") {
+  RefCounterPtr<CountedDerived> derived(new CountedDerived);
+  RefCounterPtr<CountedBase> base = derived;
+  RefCounterPtr<CountedBase> same = base;
+  CountedBase* raw = base.Get();
+
+  // Assignments and resets to the object already held.
+  CHECK(CountRmws([&] { base = base; }) == 0);
+  CHECK(CountRmws([&] { base = same; }) == 0);
+  CHECK(CountRmws([&] { base = derived; }) == 0);
+  CHECK(CountRmws([&] { base = raw; }) == 0);
+  CHECK(CountRmws([&] { base.Reset(raw); }) == 0);
+  CHECK(CountRmws([&] { base.Reset(raw, true); }) == 0);
+  CHECK(base->UseCount() == 3);
+
+  // Adopting a reference to the held object drops the surplus one.
+  raw->Increment();
+  CHECK(CountRmws([&] { base.Reset(raw, false); }) == 1);
+  CHECK(base->UseCount() == 3);
+
+  // Moves and rvalue casts transfer the reference.
+  CHECK(CountRmws([&] {
+    RefCounterPtr<CountedBase> moved = std::move(same);
+    RefCounterPtr<CountedDerived> down = ref_counter::static_pointer_cast<CountedDerived>(std::move(moved));
+    RefCounterPtr<CountedBase> up = std::move(down);
+    RefCounterPtr<CountedDerived> checked = ref_counter::dynamic_pointer_cast<CountedDerived>(std::move(up));
+    CHECK(!up);
+    same = std::move(checked);
+  }) == 0);
+  CHECK(same == derived);
+
+  RefCounterPtr<CountedBase> kept = same;
+  CHECK(CountRmws([&] {
+    RefCounterPtr<CountedOther> failed = ref_counter::dynamic_pointer_cast<CountedOther>(std::move(kept));
+    CHECK(!failed);
+  }) == 0);
+  CHECK(kept == derived);
+
+  // Changing the pointee still costs one increment and one decrement.
+  RefCounterPtr<CountedBase> other(new CountedOther);
+  CHECK(CountRmws([&] { base = other; }) == 2);
+  CHECK(CountRmws([&] { base = std::move(kept); }) == 1);
+  CHECK(derived->UseCount() == 3);
+}
+
+namespace
+{
+  class ImmortalSingleton final
+    : public RefCounter<ImmortalCounter<>>
+  {
+  public:
+    static int destroyed;
+
+    constexpr ImmortalSingleton() noexcept
+      : RefCounter(kImmortal)
+    {
+    }
+
+    int value = 42;
+
+  private:
+    void OnFinalDestroy() override {
+      ++destroyed;
+    }
+  };
+
+  int ImmortalSingleton::destroyed = 0;
+
+  ImmortalSingleton immortal_singleton;
+
+  class ImmortalMortal
+    : public RefCounter<ImmortalCounter<>>
+  {
+  public:
+    static int destroyed;
+
+  protected:
+    ~ImmortalMortal() {
+      ++destroyed;
+    }
+  };
+
+  int ImmortalMortal::destroyed = 0;
+
+  class ImmortalValue
+    : public RefCounterBase<ImmortalValue, ImmortalCounter<ThreadUnsafeCounter>>
+  {
+  public:
+    constexpr ImmortalValue() noexcept
+      : RefCounterBase(kImmortal)
+    {
+    }
+
+    // Replaces the default delete, which the compiler can not prove
+    // unreachable for an object on the stack.
+    void OnFinalDestroy() {
+      FAIL("immortal object destroyed");
+    }
+  };
+
+  // Literal with the non-atomic policy, so construction is a constant
+  // expression.
+  static_assert((ImmortalValue(), true), "constexpr immortal object");
+}
+
+TEST_CASE("Test Immortal Objects") {
+  typedef ImmortalCounter<> Policy;
+  CHECK(immortal_singleton.UseCount() == Policy::kImmortalCount);
+  {
+    RefCounterPtr<ImmortalSingleton> a(&immortal_singleton);
+    RefCounterPtr<ImmortalSingleton> b = a;
+    CHECK(b->value == 42);
+    CHECK(a->UseCount() == Policy::kImmortalCount);
+    CHECK(a->TryIncrement());
+    a->Decrement(5);
+  }
+  CHECK(immortal_singleton.UseCount() == Policy::kImmortalCount);
+  CHECK(ImmortalSingleton::destroyed == 0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < 10000; ++i)
+        RefCounterPtr<ImmortalSingleton> copy(&immortal_singleton);
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  CHECK(immortal_singleton.UseCount() == Policy::kImmortalCount);
+  CHECK(ImmortalSingleton::destroyed == 0);
+
+  // Objects built the usual way count and die as usual.
+  ImmortalMortal::destroyed = 0;
+  {
+    RefCounterPtr<ImmortalMortal> mortal(new ImmortalMortal);
+    RefCounterPtr<ImmortalMortal> copy = mortal;
+    CHECK(mortal->UseCount() == 2);
+  }
+  CHECK(ImmortalMortal::destroyed == 1);
+
+  ImmortalValue value;
+  RefCounterPtr<ImmortalValue> p(&value);
+  p.Reset();
+  CHECK(value.UseCount() == ImmortalCounter<ThreadUnsafeCounter>::kImmortalCount);
+}
+
+TEST_CASE("Test TransferToken") {
+  RefCounterPtr<CountedDerived> source(new CountedDerived);
+  CountedDerived* raw = source.Get();
+
+  RefCounterPtr<CountedBase> adopted;
+  CHECK(CountRmws([&] {
+    ref_counter::TransferToken<CountedDerived> token = source.Release();
+    CHECK(!source);
+    CHECK(token.Get() == raw);
+
+    // Tokens convert like the pointers and stay move-only.
+    ref_counter::TransferToken<CountedBase> base = std::move(token);
+    CHECK(!token);
+    std::thread consumer([&] {
+      adopted = base.Adopt();
+    });
+    consumer.join();
+    CHECK(!base);
+  }) == 0);
+  CHECK(adopted == raw);
+  CHECK(adopted->UseCount() == 1);
+
+  // Releasing an empty pointer gives an empty token.
+  RefCounterPtr<CountedDerived> empty;
+  ref_counter::TransferToken<CountedDerived> none = empty.Release();
+  CHECK(!none);
+  CHECK(!none.Adopt());
+
+  static_assert(!std::is_copy_constructible<ref_counter::TransferToken<CountedBase>>::value, "move-only");
+  static_assert(std::is_nothrow_move_constructible<ref_counter::TransferToken<CountedBase>>::value, "cheap to pass on");
+}
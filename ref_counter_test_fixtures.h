@@ -0,0 +1,89 @@
+#ifndef REF_COUNTER_TEST_FIXTURES_H_
+#define REF_COUNTER_TEST_FIXTURES_H_
+
+// Fixtures shared by the tests, not part of the library.
+
+#include "ref_counter.h"
+#include <atomic>
+
+namespace ref_counter_test
+{
+  // CounterPolicy that counts the increments and decrements made on any
+  // count of the policy. A bulk adjustment counts as one.
+  template<typename CounterPolicy>
+  struct CountingCounter
+    : CounterPolicy
+  {
+    typedef typename CounterPolicy::Type Type;
+    typedef typename CounterPolicy::ValueType ValueType;
+
+    static std::atomic<int> increments;
+    static std::atomic<int> decrements;
+
+    static int Updates() noexcept
+    {
+      return increments + decrements;
+    }
+
+    static void Reset() noexcept
+    {
+      increments = 0;
+      decrements = 0;
+    }
+
+    static void Increment(Type& counter) noexcept
+    {
+      ++increments;
+      CounterPolicy::Increment(counter);
+    }
+
+    static ValueType Decrement(Type& counter) noexcept
+    {
+      ++decrements;
+      return CounterPolicy::Decrement(counter);
+    }
+
+    static void Increment(Type& counter, ValueType n) noexcept
+    {
+      ++increments;
+      CounterPolicy::Increment(counter, n);
+    }
+
+    static ValueType Decrement(Type& counter, ValueType n) noexcept
+    {
+      ++decrements;
+      return CounterPolicy::Decrement(counter, n);
+    }
+  };
+
+  template<typename CounterPolicy> std::atomic<int> CountingCounter<CounterPolicy>::increments{ 0 };
+  template<typename CounterPolicy> std::atomic<int> CountingCounter<CounterPolicy>::decrements{ 0 };
+
+  // An object that keeps track of how many of its kind are alive.
+  template<typename CounterPolicy>
+  class Payload
+    : public ref_counter::RefCounter<CounterPolicy>
+  {
+  public:
+    static std::atomic<int> alive;
+
+    explicit Payload(int value = 0)
+      : value(value)
+    {
+      ++alive;
+    }
+
+    int value;
+
+  protected:
+    ~Payload()
+    {
+      --alive;
+    }
+  };
+
+  template<typename CounterPolicy> std::atomic<int> Payload<CounterPolicy>::alive{ 0 };
+
+} // namespace ref_counter_test
+
+#endif // REF_COUNTER_TEST_FIXTURES_H_
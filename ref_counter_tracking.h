@@ -0,0 +1,309 @@
+#ifndef REF_COUNTER_TRACKING_H_
+#define REF_COUNTER_TRACKING_H_
+
+// Reference tracking, compiled in with REF_COUNTER_TRACK_REFERENCES=1 for
+// the whole program (it changes the layout of RefCounterPtr). Every
+// RefCounterPtr that owns a reference points to a record holding the object
+// and a short stack of where the reference was taken, so the references
+// keeping an object alive can be listed at any time or at exit. Without it
+// the functions below report nothing.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#ifndef REF_COUNTER_TRACK_REFERENCES
+#define REF_COUNTER_TRACK_REFERENCES 0
+#endif
+
+#if defined(_WIN32)
+// Without NOMINMAX the min and max macros break std::numeric_limits<T>::max()
+// and std::min in every header included after this one.
+#ifndef NOMINMAX
+#define NOMINMAX
+#include <windows.h>
+#undef NOMINMAX
+#else
+#include <windows.h>
+#endif
+#elif defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+// Frames recorded per reference. 1 only records the call site, the return
+// address of the RefCounterPtr member that took the reference, which
+// roughly doubles the cost of a copy; deeper stacks go through backtrace()
+// on glibc or RtlCaptureStackBackTrace on Windows and cost about a
+// microsecond each.
+#ifndef REF_COUNTER_TRACK_STACK_DEPTH
+#define REF_COUNTER_TRACK_STACK_DEPTH 1
+#endif
+
+namespace ref_counter
+{
+  struct LiveReference
+  {
+    void const* object;
+    std::uint64_t stack_hash;
+    std::vector<void*> frames;
+  };
+
+  namespace detail
+  {
+    constexpr int kTrackedFrames = REF_COUNTER_TRACK_STACK_DEPTH;
+
+    // Fields are atomics because a dump may read a record while its owner
+    // thread reuses it; the dump then shows either version.
+    struct ReferenceRecord
+    {
+      std::atomic<void const*> object{ nullptr };
+      std::atomic<std::uint64_t> stack_hash{ 0 };
+      std::atomic<void*> frames[kTrackedFrames] = {};
+      ReferenceRecord* next_free = nullptr;
+      struct ThreadReferenceRecords* owner = nullptr;
+    };
+
+    // Records handed out by one thread. Only the owner takes records from
+    // the local free list; any thread returns a record by pushing it on the
+    // remote list, which the owner swaps out when it runs dry. A thread that
+    // exits leaves its records for the next thread to adopt.
+    struct ThreadReferenceRecords
+    {
+      static constexpr int kChunkSize = 64;
+
+      struct Chunk
+      {
+        ReferenceRecord records[kChunkSize];
+        Chunk* next;
+      };
+
+      std::atomic<Chunk*> chunks{ nullptr };
+      ReferenceRecord* free_records = nullptr;
+      std::atomic<ReferenceRecord*> remote_free{ nullptr };
+      std::atomic<bool> in_use{ true };
+      ThreadReferenceRecords* next = nullptr;
+
+      ReferenceRecord* Take() {
+        if (free_records == nullptr)
+          free_records = remote_free.exchange(nullptr, std::memory_order_acquire);
+        if (free_records == nullptr)
+          AddChunk();
+        ReferenceRecord* record = free_records;
+        free_records = record->next_free;
+        return record;
+      }
+
+      void Return(ReferenceRecord* record) noexcept {
+        record->next_free = remote_free.load(std::memory_order_relaxed);
+        while (!remote_free.compare_exchange_weak(record->next_free, record, std::memory_order_release, std::memory_order_relaxed)) {}
+      }
+
+      void AddChunk() {
+        Chunk* chunk = new Chunk;
+        for (int i = 0; i < kChunkSize; ++i) {
+          chunk->records[i].owner = this;
+          chunk->records[i].next_free = i + 1 < kChunkSize ? &chunk->records[i + 1] : nullptr;
+        }
+        free_records = &chunk->records[0];
+        chunk->next = chunks.load(std::memory_order_relaxed);
+        chunks.store(chunk, std::memory_order_release);
+      }
+    };
+
+    class ReferenceRegistry
+    {
+    public:
+      static ReferenceRecord* Acquire(void const* object, void* call_site) {
+        ReferenceRecord* record = Current().Take();
+        void* frames[kTrackedFrames] = {};
+        int count = CaptureStack(call_site, frames);
+        std::uint64_t hash = 14695981039346656037ull;
+        for (int i = 0; i < kTrackedFrames; ++i) {
+          record->frames[i].store(i < count ? frames[i] : nullptr, std::memory_order_relaxed);
+          hash = (hash ^ reinterpret_cast<std::uintptr_t>(i < count ? frames[i] : nullptr)) * 1099511628211ull;
+        }
+        record->stack_hash.store(hash, std::memory_order_relaxed);
+        record->object.store(object, std::memory_order_release);
+        return record;
+      }
+
+      static void Release(ReferenceRecord* record) noexcept {
+        record->object.store(nullptr, std::memory_order_relaxed);
+        record->owner->Return(record);
+      }
+
+      static std::vector<LiveReference> Collect() {
+        std::vector<LiveReference> live;
+        for (ThreadReferenceRecords* thread = Head().load(std::memory_order_acquire); thread != nullptr; thread = thread->next) {
+          for (ThreadReferenceRecords::Chunk* chunk = thread->chunks.load(std::memory_order_acquire); chunk != nullptr; chunk = chunk->next) {
+            for (ReferenceRecord const& record : chunk->records) {
+              void const* object = record.object.load(std::memory_order_acquire);
+              if (object == nullptr)
+                continue;
+              LiveReference reference{ object, record.stack_hash.load(std::memory_order_relaxed), {} };
+              for (std::atomic<void*> const& frame : record.frames) {
+                if (void* address = frame.load(std::memory_order_relaxed))
+                  reference.frames.push_back(address);
+              }
+              live.push_back(reference);
+            }
+          }
+        }
+        return live;
+      }
+
+    private:
+      struct Holder
+      {
+        ThreadReferenceRecords* records = Adopt();
+
+        ~Holder() {
+          records->in_use.store(false, std::memory_order_release);
+        }
+      };
+
+      static ThreadReferenceRecords& Current() {
+        static thread_local Holder holder;
+        return *holder.records;
+      }
+
+      static std::atomic<ThreadReferenceRecords*>& Head() noexcept {
+        static std::atomic<ThreadReferenceRecords*> head{ nullptr };
+        return head;
+      }
+
+      static ThreadReferenceRecords* Adopt() {
+        for (ThreadReferenceRecords* records = Head().load(std::memory_order_acquire); records != nullptr; records = records->next) {
+          if (!records->in_use.load(std::memory_order_relaxed) && !records->in_use.exchange(true, std::memory_order_acquire))
+            return records;
+        }
+        ThreadReferenceRecords* records = new ThreadReferenceRecords;
+        records->next = Head().load(std::memory_order_relaxed);
+        while (!Head().compare_exchange_weak(records->next, records, std::memory_order_release, std::memory_order_relaxed)) {}
+        return records;
+      }
+
+      // The call site, then the frames above it. The frames inside the
+      // library are skipped by finding the call site in the captured stack
+      // rather than by a fixed count, which inlining would make wrong.
+      static int CaptureStack(void* call_site, void** frames) noexcept {
+        if (call_site == nullptr)
+          return 0;
+        frames[0] = call_site;
+        int count = 1;
+#if defined(_WIN32) || defined(__GLIBC__)
+        if (kTrackedFrames > 1) {
+          constexpr int kLibraryFrames = 8;
+          void* captured[kTrackedFrames + kLibraryFrames];
+#if defined(_WIN32)
+          int captured_count = RtlCaptureStackBackTrace(0, kTrackedFrames + kLibraryFrames, captured, nullptr);
+#else
+          int captured_count = backtrace(captured, kTrackedFrames + kLibraryFrames);
+#endif
+          for (int i = 0; i < captured_count; ++i) {
+            if (captured[i] != call_site)
+              continue;
+            for (int j = i + 1; j < captured_count && count < kTrackedFrames; ++j)
+              frames[count++] = captured[j];
+            break;
+          }
+        }
+#endif
+        return count;
+      }
+    };
+
+#if REF_COUNTER_TRACK_REFERENCES
+    // Base of RefCounterPtr in tracking mode, owns the record of its
+    // reference.
+    class ReferenceTracker
+    {
+    protected:
+      constexpr ReferenceTracker() noexcept = default;
+      ReferenceTracker(ReferenceTracker const&) = delete;
+      ReferenceTracker& operator= (ReferenceTracker const&) = delete;
+
+      void TrackAcquire(void const* object, void* call_site) {
+        if (object != nullptr)
+          m_record = ReferenceRegistry::Acquire(object, call_site);
+      }
+
+      void TrackRelease() noexcept {
+        if (m_record != nullptr) {
+          ReferenceRegistry::Release(m_record);
+          m_record = nullptr;
+        }
+      }
+
+      void TrackMove(ReferenceTracker& rhs) noexcept {
+        m_record = rhs.m_record;
+        rhs.m_record = nullptr;
+      }
+
+      void TrackSwap(ReferenceTracker& rhs) noexcept {
+        std::swap(m_record, rhs.m_record);
+      }
+
+    private:
+      ReferenceRecord* m_record = nullptr;
+    };
+#endif
+  } // namespace detail
+
+  inline std::vector<LiveReference> CollectLiveReferences()
+  {
+    return detail::ReferenceRegistry::Collect();
+  }
+
+  inline std::size_t LiveReferenceCount()
+  {
+    return CollectLiveReferences().size();
+  }
+
+  // Lists the live references grouped by object, with the frames each was
+  // taken from; symbolize them with addr2line or the debugger.
+  inline void DumpLiveReferences(std::ostream& os)
+  {
+    std::map<void const*, std::vector<LiveReference>> by_object;
+    for (LiveReference& reference : CollectLiveReferences())
+      by_object[reference.object].push_back(reference);
+    for (auto const& object : by_object) {
+      os << "object " << object.first << " held by " << object.second.size() << " RefCounterPtr\n";
+      for (LiveReference const& reference : object.second) {
+        os << "  stack " << std::hex << reference.stack_hash << std::dec << ":";
+        for (void* frame : reference.frames)
+          os << ' ' << frame;
+        os << '\n';
+      }
+    }
+  }
+
+  namespace detail
+  {
+    inline void DumpLiveReferencesToStderr()
+    {
+      std::vector<LiveReference> live = CollectLiveReferences();
+      for (LiveReference const& reference : live) {
+        std::fprintf(stderr, "live reference to %p, stack %016llx:", reference.object, static_cast<unsigned long long>(reference.stack_hash));
+        for (void* frame : reference.frames)
+          std::fprintf(stderr, " %p", frame);
+        std::fprintf(stderr, "\n");
+      }
+    }
+  } // namespace detail
+
+  // Dumps whatever is still referenced when the program exits. Objects with
+  // static storage constructed before the call are still alive at that point.
+  inline void DumpLiveReferencesAtExit()
+  {
+    std::atexit(&detail::DumpLiveReferencesToStderr);
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_TRACKING_H_
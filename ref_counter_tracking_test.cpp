@@ -0,0 +1,116 @@
+#include "catch.hpp"
+#include "ref_counter.h"
+#include "ref_counter_tracking.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using ref_counter::CollectLiveReferences;
+using ref_counter::DumpLiveReferences;
+using ref_counter::LiveReference;
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+
+class TrackedNode
+  : public RefCounter<>
+{
+protected:
+  virtual ~TrackedNode() = default;
+};
+
+namespace
+{
+  long HeldReferences(void const* object)
+  {
+    std::vector<LiveReference> live = CollectLiveReferences();
+    return static_cast<long>(std::count_if(live.begin(), live.end(), [object](LiveReference const& reference) { return reference.object == object; }));
+  }
+}
+
+#if REF_COUNTER_TRACK_REFERENCES
+
+TEST_CASE("Test Reference Tracking") {
+  RefCounterPtr<TrackedNode> node(new TrackedNode);
+  TrackedNode* raw = node.Get();
+  CHECK(HeldReferences(raw) == 1);
+  {
+    RefCounterPtr<TrackedNode> copy = node;
+    RefCounterPtr<TrackedNode> moved = std::move(copy);
+    CHECK(HeldReferences(raw) == 2);
+
+    RefCounterPtr<TrackedNode> other;
+    std::thread([&] { other = node; }).join();
+    CHECK(HeldReferences(raw) == 3);
+
+    std::ostringstream dump;
+    DumpLiveReferences(dump);
+    CHECK(dump.str().find("held by 3 RefCounterPtr") != std::string::npos);
+  }
+  CHECK(HeldReferences(raw) == 1);
+
+  // A detached reference is no longer tracked until it is adopted again.
+  TrackedNode* detached = node.Detach();
+  CHECK(HeldReferences(raw) == 0);
+  node.Reset(detached, false);
+  CHECK(HeldReferences(raw) == 1);
+
+  std::vector<LiveReference> live = CollectLiveReferences();
+  auto reference = std::find_if(live.begin(), live.end(), [raw](LiveReference const& r) { return r.object == raw; });
+  REQUIRE(reference != live.end());
+  CHECK(reference->stack_hash != 0);
+
+  node.Reset();
+  CHECK(HeldReferences(raw) == 0);
+}
+
+TEST_CASE("Test Reference Tracking Call Sites") {
+  RefCounterPtr<TrackedNode> node(new TrackedNode);
+  TrackedNode* raw = node.Get();
+  // Run on its own thread so the compiler can not inline it into two places.
+  auto take = [&node](RefCounterPtr<TrackedNode>& target) { target = node; };
+  auto hashes = [raw] {
+    std::vector<std::uint64_t> result;
+    for (LiveReference const& reference : CollectLiveReferences()) {
+      if (reference.object == raw) {
+        CHECK(!reference.frames.empty());
+        result.push_back(reference.stack_hash);
+      }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  // References taken in different places are told apart.
+  {
+    RefCounterPtr<TrackedNode> first = node;
+    RefCounterPtr<TrackedNode> second = node;
+    std::vector<std::uint64_t> taken = hashes();
+    REQUIRE(taken.size() == 3);
+    CHECK(std::unique(taken.begin(), taken.end()) == taken.end());
+  }
+
+  // References taken in the same place are grouped together.
+  {
+    RefCounterPtr<TrackedNode> first;
+    RefCounterPtr<TrackedNode> second;
+    std::thread(take, std::ref(first)).join();
+    std::thread(take, std::ref(second)).join();
+    std::vector<std::uint64_t> taken = hashes();
+    REQUIRE(taken.size() == 3);
+    CHECK(std::unique(taken.begin(), taken.end()) != taken.end());
+  }
+}
+
+#else
+
+TEST_CASE("Test Reference Tracking Disabled") {
+  static_assert(sizeof(RefCounterPtr<TrackedNode>) == sizeof(TrackedNode*), "untracked pointers stay a single pointer");
+  RefCounterPtr<TrackedNode> node(new TrackedNode);
+  CHECK(HeldReferences(node.Get()) == 0);
+}
+
+#endif
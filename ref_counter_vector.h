@@ -0,0 +1,204 @@
+#ifndef REF_COUNTER_VECTOR_H_
+#define REF_COUNTER_VECTOR_H_
+
+#include "ref_counter.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace ref_counter
+{
+  // A vector of RefCounterPtr that adjusts counts in bulk: filling with n
+  // copies of one object, copying, appending a range and clearing touch the
+  // count of each object once per operation instead of once per element,
+  // wherever its references are in the vector. The references are grouped
+  // by sorting the pointers, as ParallelRelease does with
+  // ReleaseGrouping::All.
+  template<class T>
+  class RefCounterPtrVector
+  {
+  private:
+    typedef std::vector<RefCounterPtr<T>> Items;
+
+  public:
+    typedef RefCounterPtr<T> value_type;
+    typedef typename Items::size_type size_type;
+    typedef typename Items::const_iterator const_iterator;
+
+    RefCounterPtrVector() noexcept = default;
+
+    RefCounterPtrVector(size_type n, RefCounterPtr<T> const& value)
+    {
+      Append(n, value);
+    }
+
+    RefCounterPtrVector(RefCounterPtrVector const& rhs)
+    {
+      Append(rhs.begin(), rhs.end());
+    }
+
+    RefCounterPtrVector(RefCounterPtrVector&& rhs) noexcept
+      : m_items(std::move(rhs.m_items))
+    {
+    }
+
+    ~RefCounterPtrVector()
+    {
+      Clear();
+    }
+
+    RefCounterPtrVector& operator=(RefCounterPtrVector const& rhs)
+    {
+      RefCounterPtrVector(rhs).swap(*this);
+      return *this;
+    }
+
+    RefCounterPtrVector& operator=(RefCounterPtrVector&& rhs) noexcept
+    {
+      RefCounterPtrVector(std::move(rhs)).swap(*this);
+      return *this;
+    }
+
+    // Appends n references to value with a single count adjustment.
+    void Append(size_type n, RefCounterPtr<T> const& value)
+    {
+      m_items.reserve(m_items.size() + n);
+      T* p = value.Get();
+      if (p != 0)
+        AddReferences(p, n);
+      for (size_type i = 0; i < n; ++i)
+        m_items.emplace_back(p, false);
+    }
+
+    // Reads the range once, so single-pass input iterators work.
+    template<class Iterator>
+    void Append(Iterator first, Iterator last)
+    {
+      std::vector<T*> pointers;
+      for (; first != last; ++first)
+        pointers.push_back((*first).Get());
+      m_items.reserve(m_items.size() + pointers.size());
+      for (T* p : pointers)
+        m_items.emplace_back(p, false);
+      std::sort(pointers.begin(), pointers.end(), std::less<T*>());
+      for (std::size_t i = 0; i < pointers.size();) {
+        std::size_t run = Run(pointers, i);
+        if (pointers[i] != 0)
+          AddReferences(pointers[i], run);
+        i += run;
+      }
+    }
+
+    void PushBack(RefCounterPtr<T> value)
+    {
+      m_items.push_back(std::move(value));
+    }
+
+    void PopBack()
+    {
+      m_items.pop_back();
+    }
+
+    // Drops every reference, one count adjustment per object. Sorts the
+    // references in place first, so it does not allocate.
+    void Clear()
+    {
+      std::sort(m_items.begin(), m_items.end(), [](RefCounterPtr<T> const& lhs, RefCounterPtr<T> const& rhs) {
+        return std::less<T*>()(lhs.Get(), rhs.Get());
+      });
+      size_type size = m_items.size();
+      for (size_type i = 0; i < size;) {
+        T* p = m_items[i].Detach();
+        size_type run = 1;
+        while (i + run < size && m_items[i + run].Get() == p) {
+          (void)m_items[i + run].Detach();
+          ++run;
+        }
+        if (p != 0)
+          DropReferences(p, run);
+        i += run;
+      }
+      m_items.clear();
+    }
+
+    void Reserve(size_type n)
+    {
+      m_items.reserve(n);
+    }
+
+    size_type Size() const noexcept
+    {
+      return m_items.size();
+    }
+
+    bool Empty() const noexcept
+    {
+      return m_items.empty();
+    }
+
+    RefCounterPtr<T> const& operator[](size_type i) const noexcept
+    {
+      return m_items[i];
+    }
+
+    const_iterator begin() const noexcept
+    {
+      return m_items.begin();
+    }
+
+    const_iterator end() const noexcept
+    {
+      return m_items.end();
+    }
+
+    void swap(RefCounterPtrVector& rhs) noexcept
+    {
+      m_items.swap(rhs.m_items);
+    }
+
+  private:
+    typedef typename T::CountType CountType;
+
+    static CountType Step(size_type n) noexcept
+    {
+      return n > std::numeric_limits<CountType>::max() ? std::numeric_limits<CountType>::max() : static_cast<CountType>(n);
+    }
+
+    static std::size_t Run(std::vector<T*> const& pointers, std::size_t i) noexcept
+    {
+      std::size_t run = 1;
+      while (i + run < pointers.size() && pointers[i + run] == pointers[i])
+        ++run;
+      return run;
+    }
+
+    static void AddReferences(T* p, size_type n) noexcept
+    {
+      for (CountType step; n > 0; n -= step) {
+        step = Step(n);
+        p->Increment(step);
+      }
+    }
+
+    static void DropReferences(T* p, size_type n)
+    {
+      for (CountType step; n > 0; n -= step) {
+        step = Step(n);
+        p->Decrement(step);
+      }
+    }
+
+    Items m_items;
+  };
+
+  template<class T> void swap(RefCounterPtrVector<T>& lhs, RefCounterPtrVector<T>& rhs) noexcept
+  {
+    lhs.swap(rhs);
+  }
+
+} // namespace ref_counter
+
+#endif // REF_COUNTER_VECTOR_H_
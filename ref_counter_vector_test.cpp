@@ -0,0 +1,101 @@
+#include "catch.hpp"
+#include "ref_counter_vector.h"
+#include "ref_counter_test_fixtures.h"
+#include <vector>
+
+using ref_counter::RefCounter;
+using ref_counter::RefCounterPtr;
+using ref_counter::RefCounterPtrVector;
+using ref_counter::ThreadSafeCounter;
+using ref_counter::ThreadUnsafeCounter;
+
+namespace
+{
+  typedef ref_counter_test::CountingCounter<ThreadUnsafeCounter> CountingCounter;
+  typedef ref_counter_test::Payload<CountingCounter> FanOutNode;
+}
+
+class SharedNode
+  : public RefCounter<ThreadSafeCounter>
+{
+protected:
+  virtual ~SharedNode() = default;
+};
+
+TEST_CASE("Test Bulk Increment And Decrement") {
+  RefCounterPtr<SharedNode> node(new SharedNode);
+  node->Increment(10);
+  CHECK(node->UseCount() == 11);
+  node->Decrement(10);
+  CHECK(node->UseCount() == 1);
+  node->Decrement(0);
+  CHECK(node->UseCount() == 1);
+}
+
+TEST_CASE("Test RefCounterPtrVector") {
+  {
+    RefCounterPtr<FanOutNode> a(new FanOutNode);
+    RefCounterPtr<FanOutNode> b(new FanOutNode);
+    CountingCounter::Reset();
+
+    RefCounterPtrVector<FanOutNode> fan_out(100, a);
+    CHECK(fan_out.Size() == 100);
+    CHECK(a->UseCount() == 101);
+    fan_out.Append(50, b);
+    CHECK(b->UseCount() == 51);
+    CHECK(CountingCounter::Updates() == 2);
+
+    RefCounterPtrVector<FanOutNode> copy = fan_out;
+    CHECK(copy[0] == a);
+    CHECK(copy[149] == b);
+    CHECK(a->UseCount() == 201);
+    CHECK(CountingCounter::Updates() == 4);
+
+    std::vector<RefCounterPtr<FanOutNode>> plain(3, a);
+    CountingCounter::Reset();
+    copy.Append(plain.begin(), plain.end());
+    CHECK(CountingCounter::Updates() == 1);
+    CHECK(a->UseCount() == 207);
+
+    CountingCounter::Reset();
+    copy.Clear();
+    CHECK(copy.Empty());
+    CHECK(CountingCounter::Updates() == 2);
+    CHECK(a->UseCount() == 104);
+
+    fan_out = RefCounterPtrVector<FanOutNode>();
+    CHECK(a->UseCount() == 4);
+    CHECK(b->UseCount() == 1);
+  }
+  CHECK(FanOutNode::alive == 0);
+
+  {
+    // Interleaved references are grouped by object, not only adjacent runs.
+    RefCounterPtr<FanOutNode> a(new FanOutNode);
+    RefCounterPtr<FanOutNode> b(new FanOutNode);
+    std::vector<RefCounterPtr<FanOutNode>> plain{ a, b, a, RefCounterPtr<FanOutNode>(), b, a };
+    RefCounterPtrVector<FanOutNode> mixed;
+    CountingCounter::Reset();
+    mixed.Append(plain.begin(), plain.end());
+    CHECK(CountingCounter::Updates() == 2);
+    CHECK(a->UseCount() == 7);
+    CHECK(b->UseCount() == 5);
+    CHECK(mixed[1] == b);
+    CHECK(!mixed[3]);
+
+    plain.clear();
+    CountingCounter::Reset();
+    mixed.Clear();
+    CHECK(CountingCounter::Updates() == 2);
+    CHECK(a->UseCount() == 1);
+    CHECK(b->UseCount() == 1);
+  }
+  CHECK(FanOutNode::alive == 0);
+
+  RefCounterPtrVector<FanOutNode> last(10, RefCounterPtr<FanOutNode>(new FanOutNode));
+  CHECK(FanOutNode::alive == 1);
+  CountingCounter::Reset();
+  last.Clear();
+  CHECK(CountingCounter::Updates() == 1);
+  CHECK(FanOutNode::alive == 0);
+}